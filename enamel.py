@@ -4,10 +4,14 @@ import collections
 import re
 import sys
 import array
+import hashlib
+import shutil
+import fnmatch
 
 try:
     from jinja2 import Environment
     from jinja2 import FileSystemLoader
+    from jinja2 import ModuleLoader
 except ImportError as e:
     if 'sdk-core' in sys.prefix :
         message = 'Jinja2 module is missing, you probably forgot to patch your current sdk\n'
@@ -69,11 +73,667 @@ def settingscount(settings):
             count = count + 1
     return count
 
+class EnamelError(Exception):
+    """Error in the configuration that must stop the build"""
+    pass
+
+def fnv1a(string):
+    """32-bit FNV-1a hash of a string, same algorithm as enamel_hash() in enamel.h"""
+    h = 0x811C9DC5
+    for c in bytearray(string.encode('utf-8')):
+        h = ((h ^ c) * 0x01000193) & 0xFFFFFFFF
+    return h
+
+def keycount(item):
+    """Return the number of message keys used by the item (one per option for a checkboxgroup)"""
+    return len(item['options']) if item['type'] == 'checkboxgroup' else 1
+
 def hashkey(item):
+    """Return the key of the item in the persisted settings : FNV-1a of its messageKey"""
+    messageKey = item['messageKey']
+    if item['type'] == 'checkboxgroup' :
+        messageKey = messageKey + '[' + str(len(item['options'])) + ']'
+    return fnv1a(messageKey)
+
+def legacyhash(item):
+    """Return the key of the item in the settings persisted by the versions of Enamel before FNV-1a : the low 32 bits
+    of the Python 2 hash() of its messageKey, computed here to not depend on the Python running the generator"""
     messageKey = item['messageKey']
     if item['type'] == 'checkboxgroup' :
         messageKey = messageKey + '[' + str(len(item['options'])) + ']'
-    return hash(messageKey) & 0xFFFFFFFF
+    h = ord(messageKey[0]) << 7
+    for c in messageKey :
+        h = ((1000003 * h) ^ ord(c)) & 0xFFFFFFFFFFFFFFFF
+    return (h ^ len(messageKey)) & 0xFFFFFFFF
+
+def checkhashes(config):
+    """Fail if the hashes of two different messageKeys overlap (a checkboxgroup uses hash..hash+options-1)"""
+    ranges = {}
+    for setting in getsettings(config) :
+        item = setting['item']
+        ranges[item['messageKey']] = (hashkey(item), hashkey(item) + keycount(item) - 1)
+    previous = None
+    for messageKey, (first, last) in sorted(ranges.items(), key=lambda r: r[1]) :
+        if first == 0 or last > 0xFFFFFFFF :
+            raise EnamelError('Enamel: the hash of the messageKey "%s" is reserved, please rename it' % messageKey)
+        if previous and first <= previous[1][1] :
+            raise EnamelError('Enamel: the messageKeys "%s" and "%s" have colliding hashes, please rename one of them' % (previous[0], messageKey))
+        previous = (messageKey, (first, last))
+
+def getsettings(config):
+    """Return the flat list of settings handled by Enamel, each one with the capabilities of its section
+    and the persisted chunk it belongs to (0 for the items outside of a section, then one chunk per section)"""
+    settings = []
+    chunk = 0
+    for item in config :
+        items = [item]
+        capabilities = []
+        itemchunk = 0
+        if item['type'] == 'section' :
+            chunk = chunk + 1
+            items = item['items']
+            capabilities = item['capabilities'] if 'capabilities' in item else []
+            itemchunk = chunk
+        for subitem in items :
+            if 'messageKey' in subitem and 'enamel-ignore' not in subitem and 'enamel-frozen' not in subitem :
+                settings.append({
+                    'item' : subitem,
+                    'capabilities' : capabilities + (subitem['capabilities'] if 'capabilities' in subitem else []),
+                    'chunk' : itemchunk
+                })
+    return settings
+
+def freeze(config, frozen):
+    """Freeze the items of the overlay to the given values : their getters return constants and they are neither
+    received nor persisted"""
+    # a messageKey can be declared in sections with exclusive capabilities : all its declarations are frozen
+    items = collections.defaultdict(list)
+    for item in config :
+        for subitem in (item['items'] if item['type'] == 'section' else [item]) :
+            if 'messageKey' in subitem and 'enamel-ignore' not in subitem :
+                items[subitem['messageKey']].append(subitem)
+    for messageKey, value in frozen.items() :
+        if messageKey not in items :
+            raise EnamelError('Enamel: the frozen messageKey "%s" is not a setting of the configuration' % messageKey)
+        for item in items[messageKey] :
+            item['defaultValue'] = value
+            item['enamel-frozen'] = True
+
+def getfrozen(item):
+    """Return the C expression of the value of a frozen item"""
+    if getkind(item) == 'checkboxgroup' :
+        values = item['defaultValue']
+        mask = sum(1 << i for i in range(len(item['options'])) if i < len(values) and values[i])
+        return 'index < %d && ((0x%Xu >> index) & 1)' % (len(item['options']), mask)
+    return getdefault(item)
+
+def getvalue(item):
+    """Return the C expression reading the value of an item in enamel_settings"""
+    if getkind(item) == 'checkboxgroup' :
+        return 'index < %d ? enamel_settings.%s[index] : false' % (len(item['options']), cvarname(getid(item)))
+    return 'enamel_settings.%s' % cvarname(getid(item))
+
+def settingids(config):
+    """Return the ids of the settings in the order of EnamelSetting : a messageKey declared in sections with exclusive
+    capabilities is one setting"""
+    ids = []
+    for setting in getsettings(config) :
+        if getid(setting['item']) not in ids :
+            ids.append(getid(setting['item']))
+    return ids
+
+def chunkcount(config):
+    """Return the number of persisted chunks : one for the items outside of a section and one per section"""
+    return 1 + len([item for item in config if item['type'] == 'section'])
+
+# Persist key slots of the chunks, ENAMEL_CHUNK_PKEY(slot) in enamel.c
+CHUNK_SLOTS = 4096
+
+def chunkslots(config):
+    """Return the persist key slot of each chunk : the FNV-1a hash of the messageKeys declared in its section and of
+    the capabilities of the section, so that adding, removing or moving another section does not move the chunk.
+    A slot already taken gives the next free one, in the order of the hashes to not depend on the order of the sections"""
+    names = [[]]
+    for item in config :
+        if item['type'] == 'section' :
+            capabilities = item['capabilities'] if 'capabilities' in item else []
+            names.append(sorted(set(subitem['messageKey'] for subitem in item['items'] if 'messageKey' in subitem)) + ['|'] + sorted(capabilities))
+        elif 'messageKey' in item :
+            names[0].append(item['messageKey'])
+    names[0] = sorted(set(names[0]))
+    names = [','.join(name) for name in names]
+    slots = [None] * len(names)
+    for chunk in sorted(range(len(names)), key=lambda chunk: (fnv1a(names[chunk]) % CHUNK_SLOTS, names[chunk])) :
+        slot = fnv1a(names[chunk]) % CHUNK_SLOTS
+        while slot in slots :
+            slot = (slot + 1) % CHUNK_SLOTS
+        slots[chunk] = slot
+    return slots
+
+def getmaxlength(item):
+    """Return the 'maxlength' attribute of an input, None if it is not set"""
+    if 'attributes' in item and 'maxlength' in item['attributes'] :
+        return int(item['attributes']['maxlength'])
+    return None
+
+# maximum size of a character in UTF-8, the encoding of the strings sent by the phone
+UTF8_MAX_BYTES = 4
+
+def getcapacity(item):
+    """Return the C expression of the size of the buffer holding a string setting. The 'maxlength' of an input
+    counts characters as in HTML : the buffer holds maxlength characters of UTF-8 and the terminating NUL"""
+    if item['type'] == 'input' :
+        maxlength = getmaxlength(item)
+        if maxlength is None :
+            return 'ENAMEL_MAX_STRING_LENGTH'
+        default = len(item['defaultValue'].encode('utf-8')) if 'defaultValue' in item else 0
+        return str(max(UTF8_MAX_BYTES * maxlength, default) + 1)
+    return str(max(maxdictsize(item), len(getdefault(item)) - 1))
+
+def getprecision(item):
+    """Return the precision of a slider (10^number of decimals of its step)"""
+    if 'step' in item and '.' in str(item['step']) :
+        return 10**(len(str(item['step'] - int(item['step']))) - 2)
+    return 1
+
+def getkind(item):
+    """Return how the value of the given item is stored : toggle, color, slider, checkboxgroup, enum, time or string"""
+    if item['type'] == 'select' or item['type'] == 'radiogroup' :
+        return 'string' if hasStringOptions(item) else 'enum'
+    if item['type'] == 'input' :
+        return 'time' if 'attributes' in item and item['attributes'].get('type') == 'time' else 'string'
+    return item['type']
+
+def haskind(config, kind):
+    """Return True if at least one setting of the config is stored as the given kind"""
+    return any(getkind(setting['item']) == kind for setting in getsettings(config))
+
+def helpercondition(config, kinds=None, maxlength=False):
+    """Return the C condition compiling the settings of the given kinds (all the settings if None), or of the inputs
+    with a maxlength, which guards the helpers they use : None without such setting, '' if one of them is always compiled"""
+    conditions = []
+    for setting in getsettings(config) :
+        item = setting['item']
+        if (kinds is None or getkind(item) in kinds) and (not maxlength or getmaxlength(item)) :
+            if not setting['capabilities'] :
+                return ''
+            condition = '(' + getdefines(setting['capabilities']) + ')'
+            if condition not in conditions :
+                conditions.append(condition)
+    return ' || '.join(conditions) if conditions else None
+
+def timeseconds(value):
+    """Convert a 'HH:MM' or 'HH:MM:SS' string to a number of seconds"""
+    parts = [int(part) for part in value.split(':')]
+    return parts[0] * 3600 + parts[1] * 60 + (parts[2] if len(parts) > 2 else 0)
+
+def getdefault(item):
+    """Return the C expression of the default value of the given item"""
+    kind = getkind(item)
+    if kind == 'toggle' :
+        return str(item['defaultValue'] if 'defaultValue' in item else False).lower()
+    elif kind == 'enum' :
+        return str(item['defaultValue'] if 'defaultValue' in item else 0)
+    elif kind == 'time' :
+        return str(timeseconds(item['defaultValue'] if 'defaultValue' in item else '00:00:00'))
+    elif kind == 'string' :
+        if item['type'] == 'input' :
+            return '"%s"' % (item['defaultValue'] if 'defaultValue' in item else '')
+        return '"%s"' % (item['defaultValue'] if 'defaultValue' in item else item['options'][0]['value'])
+    elif kind == 'color' :
+        if 'defaultValue' in item and isinstance(item['defaultValue'], basestring) :
+            return 'GColorFromHEX(0x%s)' % item['defaultValue']
+        return 'GColorFromHEX(%s)' % (item['defaultValue'] if 'defaultValue' in item else 0)
+    elif kind == 'slider' :
+        return str(int(item['defaultValue'] * getprecision(item)) if 'defaultValue' in item else 0)
+    elif kind == 'checkboxgroup' :
+        defaults = item['defaultValue'] if 'defaultValue' in item else []
+        return '{ %s }' % ', '.join(str(i < len(defaults) and defaults[i]).lower() for i in range(len(item['options'])))
+    return '0'
+
+def getreset(item):
+    """Return the C statements setting the field of the item to its default value. The fields are assigned one by one
+    instead of copied from a constant EnamelSettings, which Pebble would load in the app RAM next to the settings"""
+    field = 'enamel_private_settings.' + cvarname(getid(item))
+    kind = getkind(item)
+    if kind == 'string' :
+        default = getdefault(item)
+        return [field + "[0] = '\\0';"] if default == '""' else ['strcpy(%s, %s);' % (field, default)]
+    elif kind == 'checkboxgroup' :
+        defaults = item['defaultValue'] if 'defaultValue' in item else []
+        return ['%s[%d] = %s;' % (field, i, str(i < len(defaults) and defaults[i]).lower()) for i in range(len(item['options']))]
+    return ['%s = %s;' % (field, getdefault(item))]
+
+def getpacktype(item):
+    """Return how the value of the given item is packed in the persisted chunks"""
+    kind = getkind(item)
+    if kind == 'toggle' or kind == 'checkboxgroup' :
+        return 'PACK_BOOL'
+    elif kind == 'color' :
+        return 'PACK_COLOR'
+    elif kind == 'string' :
+        return 'PACK_STRING'
+    return 'PACK_INT32'
+
+# default value of ENAMEL_MAX_STRING_LENGTH, used to report the persisted sizes
+MAX_STRING_LENGTH = 100
+
+def stringlength(item):
+    """Return the maximum length of a string setting, without the terminating NUL"""
+    capacity = getcapacity(item)
+    return (MAX_STRING_LENGTH if capacity == 'ENAMEL_MAX_STRING_LENGTH' else int(capacity)) - 1
+
+def getdictsize(item):
+    """Return the C expression of the maximum size of the item in a Pebble Dictionary : for each tuple a 7 bytes header
+    and its value (integers and booleans are sent as int32 by PebbleKit JS, select values and times as strings)"""
+    kind = getkind(item)
+    if kind == 'string' :
+        return '7 + ' + getcapacity(item)
+    elif kind == 'enum' :
+        return '7 + %d' % maxdictsize(item)
+    elif kind == 'time' :
+        return '7 + %d' % (len('HH:MM:SS') + 1)
+    elif kind == 'checkboxgroup' :
+        return '(7 + 4) * %d' % keycount(item)
+    return '7 + 4'
+
+def dictsize(item):
+    """Return the maximum size of the item in a Pebble Dictionary with the default ENAMEL_MAX_STRING_LENGTH"""
+    kind = getkind(item)
+    if kind == 'string' :
+        return 7 + stringlength(item) + 1
+    elif kind == 'enum' :
+        return 7 + maxdictsize(item)
+    elif kind == 'time' :
+        return 7 + len('HH:MM:SS') + 1
+    return (7 + 4) * keycount(item)
+
+def rawsize(settings):
+    """Return the maximum size of the settings stored as a raw Pebble Dictionary (1 byte for the count of tuples)"""
+    return 1 + sum(dictsize(setting['item']) for setting in settings)
+
+PLATFORMS = collections.OrderedDict([
+    ('aplite',  ['PLATFORM_APLITE', 'BW', 'RECT', 'DISPLAY_144x168']),
+    ('basalt',  ['PLATFORM_BASALT', 'COLOR', 'RECT', 'DISPLAY_144x168', 'MICROPHONE', 'SMARTSTRAP', 'SMARTSTRAP_POWER', 'HEALTH']),
+    ('chalk',   ['PLATFORM_CHALK', 'COLOR', 'ROUND', 'DISPLAY_180x180_ROUND', 'MICROPHONE', 'SMARTSTRAP', 'SMARTSTRAP_POWER', 'HEALTH']),
+    ('diorite', ['PLATFORM_DIORITE', 'BW', 'RECT', 'DISPLAY_144x168', 'MICROPHONE', 'SMARTSTRAP', 'SMARTSTRAP_POWER', 'HEALTH']),
+    ('emery',   ['PLATFORM_EMERY', 'COLOR', 'RECT', 'DISPLAY_200x228', 'MICROPHONE', 'SMARTSTRAP', 'SMARTSTRAP_POWER', 'HEALTH']),
+])
+
+def hascapabilities(platform, capabilities):
+    """Return True if the platform has all the given capabilities, same as the #if generated by getdefines"""
+    for capability in capabilities :
+        if capability.startswith('NOT_') :
+            if capability[4:] in PLATFORMS[platform] :
+                return False
+        elif capability not in PLATFORMS[platform] :
+            return False
+    return True
+
+def platformmacros(platform):
+    """Return the macros of the Pebble SDK defined on the platform, according to its capabilities"""
+    return set(['PBL_SDK_3'] + ['PBL_' + capability for capability in PLATFORMS[platform] if not capability.startswith('DISPLAY_')])
+
+KNOWN_MACROS = set(['PBL_SDK_2']).union(*[platformmacros(platform) for platform in PLATFORMS])
+
+def tristate_not(value):
+    return None if value is None else not value
+
+def tristate_and(values):
+    values = list(values)
+    return False if False in values else (None if None in values else True)
+
+def tristate_or(values):
+    values = list(values)
+    return True if True in values else (None if None in values else False)
+
+def evaluatecondition(expression, macros):
+    """Evaluate the expression of a #if with the given defined macros : True, False or None when it depends on
+    macros which are not known to be defined or not on the platforms (the code is then considered as compiled)"""
+    tokens = re.findall(r'\|\||&&|[()!]|\w+|\S', expression)
+    position = [0]
+
+    def peek():
+        return tokens[position[0]] if position[0] < len(tokens) else None
+
+    def take():
+        position[0] += 1
+        return tokens[position[0] - 1]
+
+    def primary():
+        token = take()
+        if token == '!' :
+            return tristate_not(primary())
+        if token == '(' :
+            value = disjunction()
+            if take() != ')' :
+                raise ValueError
+            return value
+        if token == 'defined' :
+            parenthesis = peek() == '('
+            if parenthesis :
+                take()
+            name = take()
+            if parenthesis and take() != ')' :
+                raise ValueError
+            return name in macros if name in KNOWN_MACROS else None
+        if token.isdigit() :
+            return int(token) != 0
+        if re.match(r'\w+$', token) and peek() == '(' :
+            # function-like macro such as PBL_API_EXISTS(...)
+            depth = 0
+            while True :
+                token = take()
+                depth += 1 if token == '(' else (-1 if token == ')' else 0)
+                if depth == 0 :
+                    return None
+        if re.match(r'\w+$', token) :
+            return (token in macros) if token in KNOWN_MACROS else None
+        raise ValueError
+
+    def conjunction():
+        values = [primary()]
+        while peek() == '&&' :
+            take()
+            values.append(primary())
+        return tristate_and(values)
+
+    def disjunction():
+        values = [conjunction()]
+        while peek() == '||' :
+            take()
+            values.append(conjunction())
+        return tristate_or(values)
+
+    try :
+        value = disjunction()
+        return value if position[0] == len(tokens) else None
+    except (ValueError, IndexError) :
+        return None
+
+def stripcomments(source):
+    """Replace the comments and the string literals of a C source by spaces, keeping its lines"""
+    def blank(match):
+        text = match.group(0)
+        if text.startswith('/') :
+            return re.sub(r'[^\n]', ' ', text)
+        return text[0] + text[0]
+    return re.sub(r'//[^\n]*|/\*.*?\*/|"(?:\\.|[^"\\\n])*"|\'(?:\\.|[^\'\\\n])*\'', blank, source, flags=re.DOTALL)
+
+def scansource(path, source, macros, references):
+    """Add to references the identifiers of the source compiled with the given macros, with their first location.
+    The identifiers of the preprocessor directives are not references, except the replacement text of a #define"""
+    source = stripcomments(source.replace('\\\n', ' \n'))
+    # for each #if : (code of the #if compiled, code of the current branch compiled, a previous branch was compiled)
+    stack = []
+    active = True
+    for number, line in enumerate(source.split('\n'), 1) :
+        directive = re.match(r'\s*#\s*(\w+)\s*(.*)', line)
+        if directive :
+            name, expression = directive.group(1), directive.group(2).strip()
+            if name in ['if', 'ifdef', 'ifndef'] :
+                if name == 'ifdef' :
+                    expression = 'defined(%s)' % expression
+                elif name == 'ifndef' :
+                    expression = '!defined(%s)' % expression
+                condition = evaluatecondition(expression, macros)
+                stack.append([active, condition])
+                active = tristate_and([active, condition])
+            elif name == 'elif' and stack :
+                parent, taken = stack[-1]
+                condition = evaluatecondition(expression, macros)
+                active = tristate_and([parent, tristate_not(taken), condition])
+                stack[-1][1] = tristate_or([taken, condition])
+            elif name == 'else' and stack :
+                parent, taken = stack[-1]
+                active = tristate_and([parent, tristate_not(taken)])
+            elif name == 'endif' and stack :
+                active = stack.pop()[0]
+            elif name == 'define' and active is not False :
+                # the replacement text follows the macro name and its parameters
+                replacement = re.match(r'[A-Za-z_]\w*(?:\([^)]*\))?(.*)', expression)
+                if replacement :
+                    for identifier in re.findall(r'[A-Za-z_]\w*', replacement.group(1)) :
+                        references.setdefault(identifier, '%s:%d' % (path, number))
+            continue
+        if active is not False :
+            for identifier in re.findall(r'[A-Za-z_]\w*', line) :
+                references.setdefault(identifier, '%s:%d' % (path, number))
+
+def sourcefiles(paths):
+    """Return the C files given directly or found in the given folders"""
+    files = []
+    for path in paths :
+        if os.path.isdir(path) :
+            for root, dirs, names in os.walk(path) :
+                files += [os.path.join(root, name) for name in sorted(names) if fnmatch.fnmatch(name, '*.[ch]')]
+        else :
+            files.append(path)
+    return files
+
+def getusage(paths):
+    """Return for each platform the identifiers referenced by the C sources compiled on this platform"""
+    sources = [(path, readfile(path).decode('utf-8', 'replace')) for path in sourcefiles(paths)]
+    usage = collections.OrderedDict()
+    for platform in PLATFORMS :
+        references = {}
+        for path, source in sources :
+            scansource(path, source, platformmacros(platform), references)
+        usage[platform] = references
+    return usage
+
+def isused(item, references):
+    """Return True if the getter, the index or the hash of the item is referenced, or its field if the app reads
+    enamel_settings or a snapshot"""
+    name = cvarname(getid(item))
+    if 'enamel_get_' + name in references or 'ENAMEL_SETTING_' + name.upper() in references or 'ENAMEL_HASH_' + name.upper() in references :
+        return True
+    return name in references and ('enamel_settings' in references or 'EnamelSettings' in references)
+
+def configitems(config):
+    """Return the items of the config with a messageKey and the capabilities of their section"""
+    items = []
+    for item in config :
+        if item['type'] == 'section' :
+            capabilities = item['capabilities'] if 'capabilities' in item else []
+            items += [(subitem, capabilities) for subitem in item['items'] if 'messageKey' in subitem]
+        elif 'messageKey' in item :
+            items.append((item, []))
+    return items
+
+# Functions of enamel.h named like the getters of the settings
+API_GETTERS = ['enamel_get_stats']
+
+def prune(config, usage):
+    """Ignore the settings the C sources never use and restrict the others to the platforms using them.
+    Return the warnings about the getters used by the sources without setting on a platform"""
+    items = configitems(config)
+    for item, capabilities in items :
+        if 'enamel-ignore' in item or 'enamel-frozen' in item :
+            continue
+        platforms = [platform for platform in PLATFORMS if isused(item, usage[platform])]
+        if not platforms :
+            item['enamel-ignore'] = True
+        elif len(platforms) < len(PLATFORMS) :
+            # Clay still sends the setting on the other platforms
+            item['enamel-clay-capabilities'] = item['capabilities'] if 'capabilities' in item else []
+            item['capabilities'] = (item['capabilities'] if 'capabilities' in item else []) + ['NOT_PLATFORM_' + platform.upper() for platform in PLATFORMS if platform not in platforms]
+
+    # a messageKey can be declared in sections with exclusive capabilities
+    getters = collections.defaultdict(list)
+    for item, capabilities in items :
+        getters['enamel_get_' + cvarname(getid(item))].append((item, capabilities))
+    warnings = []
+    for platform, references in usage.iteritems() :
+        for identifier, location in sorted(references.iteritems(), key=lambda reference: reference[1]) :
+            if not identifier.startswith('enamel_get_') or identifier in API_GETTERS :
+                continue
+            if identifier not in getters :
+                warnings.append('%s: %s is not a setting of the configuration' % (location, identifier))
+                continue
+            declarations = [(item, capabilities) for item, capabilities in getters[identifier] if 'enamel-ignore' not in item]
+            if not declarations :
+                warnings.append('%s: %s is ignored by the configuration' % (location, identifier))
+            elif not any(hascapabilities(platform, capabilities + (item['capabilities'] if 'capabilities' in item else [])) for item, capabilities in declarations) :
+                warnings.append('%s: %s is not available on %s' % (location, identifier, platform))
+    return sorted(set(warnings))
+
+def sentsettings(config):
+    """Return the flat list of the items sent by Clay, each one with the capabilities of its section : the ignored,
+    frozen and pruned settings are sent too, so they count in the inbox size"""
+    settings = []
+    for item, capabilities in configitems(config) :
+        if 'enamel-clay-capabilities' in item :
+            capabilities = capabilities + item['enamel-clay-capabilities']
+        elif 'capabilities' in item :
+            capabilities = capabilities + item['capabilities']
+        settings.append({'item' : item, 'capabilities' : capabilities})
+    return settings
+
+def inboxsize(config, platform):
+    """Return the inbox size requested by Enamel on the given platform with the default ENAMEL_MAX_STRING_LENGTH,
+    including the sequence number and the resync flag sent by the enamel JS module. Without ENAMEL_INBOX_MAX_SIZE
+    the settings are sent in a single message, without the count of remaining messages"""
+    return 1 + 2 * (7 + 4) + sum(dictsize(setting['item']) for setting in sentsettings(config) if hascapabilities(platform, setting['capabilities']))
+
+def platformsettings(config, platform):
+    """Return the settings compiled on the given platform, all the settings if platform is None"""
+    return [setting for setting in getsettings(config) if platform is None or hascapabilities(platform, setting['capabilities'])]
+
+def packedlengthsize(config):
+    """Return the size of the length of the packed strings (PackedLength) : 1 byte unless a string setting of the
+    config can hold more than 255 bytes"""
+    longest = max([stringlength(setting['item']) for setting in getsettings(config) if getpacktype(setting['item']) == 'PACK_STRING'] + [0])
+    return 2 if longest > 255 else 1
+
+def packedsize(settings, lengthsize):
+    """Return the maximum size of the settings in the packed chunks : 9 bytes header, 1 bit per boolean,
+    4 bytes per integer, 1 byte per color, length (lengthsize bytes) and characters per string, 4 bytes checksum"""
+    bits = collections.defaultdict(int)
+    sizes = collections.defaultdict(int)
+    for setting in settings :
+        item = setting['item']
+        packtype = getpacktype(item)
+        if packtype == 'PACK_BOOL' :
+            bits[setting['chunk']] += keycount(item)
+        elif packtype == 'PACK_COLOR' :
+            sizes[setting['chunk']] += 1
+        elif packtype == 'PACK_STRING' :
+            sizes[setting['chunk']] += lengthsize + stringlength(item)
+        else :
+            sizes[setting['chunk']] += 4
+    chunks = set(bits.keys()) | set(sizes.keys())
+    return sum(9 + (bits[chunk] + 7) // 8 + sizes[chunk] + 4 for chunk in chunks)
+
+# Persist keys of a chunk (ENAMEL_CHUNK_MAX_PKEYS) and bytes per key (PERSIST_DATA_MAX_LENGTH)
+CHUNK_MAX_PKEYS = 16
+PERSIST_DATA_MAX_LENGTH = 256
+
+def checkchunks(config):
+    """Fail if a chunk of settings does not fit in its persist keys on a platform, or if the slots of the chunks do
+    not fit in one persist key"""
+    if chunkcount(config) * 2 > PERSIST_DATA_MAX_LENGTH :
+        raise EnamelError('Enamel: the configuration has %d sections, over the %d sections Enamel can persist' % (chunkcount(config) - 1, PERSIST_DATA_MAX_LENGTH // 2 - 1))
+    for platform in PLATFORMS :
+        for chunk in range(chunkcount(config)) :
+            settings = [setting for setting in platformsettings(config, platform) if setting['chunk'] == chunk]
+            size = packedsize(settings, packedlengthsize(config))
+            if size > CHUNK_MAX_PKEYS * PERSIST_DATA_MAX_LENGTH :
+                raise EnamelError('Enamel: the settings %s use %d bytes of persistent storage on %s, over the %d bytes of a chunk, please move some of them to another section'
+                    % ('outside of the sections' if chunk == 0 else 'of the section %d' % chunk, size, platform, CHUNK_MAX_PKEYS * PERSIST_DATA_MAX_LENGTH))
+
+def fieldsize(item):
+    """Return the size and the alignment of the field of the item in EnamelSettings"""
+    kind = getkind(item)
+    if kind in ['slider', 'enum', 'time'] :
+        return 4, 4
+    elif kind == 'checkboxgroup' :
+        return keycount(item), 1
+    elif kind == 'string' :
+        capacity = getcapacity(item)
+        return (MAX_STRING_LENGTH if capacity == 'ENAMEL_MAX_STRING_LENGTH' else int(capacity)), 1
+    return 1, 1
+
+def structsize(settings):
+    """Return sizeof(EnamelSettings) for the given settings on a 32-bit ARM"""
+    size = 0
+    alignment = 1
+    for setting in settings :
+        fsize, falignment = fieldsize(setting['item'])
+        size = (size + falignment - 1) // falignment * falignment + fsize
+        alignment = max(alignment, falignment)
+    return (size + alignment - 1) // alignment * alignment
+
+# Estimated sizes of the Thumb-2 code generated by enamel.c.jinja, calibrated on -Os builds :
+# code independent of the configuration, code per setting (key range, apply case, chunk packing),
+# out-of-line getter, comparison per option of an enum and assignment of a default value
+CODE_BASE_SIZE = 1150
+CODE_SETTING_SIZES = {'toggle': 100, 'color': 120, 'slider': 100, 'enum': 95, 'time': 130, 'checkboxgroup': 125, 'string': 120}
+CODE_GETTER_SIZE = 12
+CODE_ENUM_OPTION_SIZE = 9
+CODE_RESET_SIZE = 8
+
+# SettingLayout and MessageKeyRange entries, default ENAMEL_MAX_SUBSCRIBERS and PersistStream
+LAYOUT_SIZE = 12
+KEY_RANGE_SIZE = 12
+MAX_SUBSCRIBERS = 8
+PERSIST_STREAM_SIZE = 12 + 256
+
+def codesize(item):
+    """Return the estimated size of the code generated for the item"""
+    kind = getkind(item)
+    size = CODE_SETTING_SIZES[kind]
+    if kind == 'enum' :
+        size += CODE_ENUM_OPTION_SIZE * len(getOptionArray(item))
+    if 'enamel-inline' not in item :
+        size += CODE_GETTER_SIZE
+    # a string default is copied from its literal
+    size += CODE_RESET_SIZE * len(getreset(item)) + (len(getdefault(item)) - 1 if kind == 'string' else 0)
+    return size
+
+def footprint(config, platform):
+    """Return the memory used by Enamel on the given platform with the default ENAMEL_MAX_STRING_LENGTH and without
+    ENAMEL_INBOX_MAX_SIZE. The code and the constants are loaded in the app RAM by Pebble so they count in 'ram'"""
+    settings = platformsettings(config, platform)
+    masksize = 4 * ((len(settingids(config)) + 31) // 32)
+    items = collections.OrderedDict((getid(setting['item']), codesize(setting['item'])) for setting in settings)
+    settingssize = structsize(settings)
+    # enamel_settings, key ranges, table of the handlers, mask of the changed settings, dirty chunks and their slots,
+    # the other variables of enamel.c
+    subscribers = MAX_SUBSCRIBERS * (16 + masksize)
+    static = settingssize + KEY_RANGE_SIZE * len(settings) + subscribers + masksize + 3 * chunkcount(config) + 32
+    # s_layouts
+    code = CODE_BASE_SIZE + sum(items.values()) + LAYOUT_SIZE * len(settings)
+    # inbox
+    heap = inboxsize(config, platform)
+    return collections.OrderedDict([
+        ('ram', code + static + heap),
+        ('code', code),
+        ('static', static),
+        ('heap', heap),
+        ('subscribers', subscribers),
+        ('stack', PERSIST_STREAM_SIZE),
+        ('persist', packedsize(settings, packedlengthsize(config))),
+        ('items', items),
+    ])
+
+BUDGET_KEYS = ['ram', 'code', 'static', 'heap', 'persist']
+
+def checkbudget(footprints, budget):
+    """Raise an EnamelError if a footprint is over the budget, a JSON object giving for each platform (or 'all')
+    the maximum of some of the BUDGET_KEYS"""
+    errors = []
+    for platform, limits in budget.iteritems() :
+        if platform != 'all' and platform not in PLATFORMS :
+            raise EnamelError("Enamel: unknown platform '%s' in the budget" % platform)
+        for key, limit in limits.iteritems() :
+            if key not in BUDGET_KEYS :
+                raise EnamelError("Enamel: unknown budget '%s', use one of %s" % (key, ', '.join(BUDGET_KEYS)))
+            for name in (PLATFORMS if platform == 'all' else [platform]) :
+                if footprints[name][key] > limit :
+                    errors.append('%s uses %d bytes of %s, over its budget of %d bytes' % (name, footprints[name][key], key, limit))
+    if errors :
+        raise EnamelError('Enamel: ' + '\nEnamel: '.join(errors))
 
 def getOptionArray(item):
     options = []
@@ -110,54 +770,194 @@ def removeComments(string):
     string = re.sub(re.compile("^\s+//.*?\n" ) ,"" ,string) # remove all occurance singleline comments (//COMMENT\n ) from string
     return string
 
-def generate(configFile='src/js/config.json', outputDir='src/generated'):
-    """Generates C helpers from a Clay configuration file"""
-    # create output folder
-    if not os.path.exists(outputDir):
-        os.makedirs(outputDir)
+TEMPLATES = ['enamel.h.jinja', 'enamel.c.jinja']
+
+def templatesdir():
+    return os.path.join(os.path.dirname(os.path.abspath(__file__)), 'templates')
+
+def getversion():
+    """Return the version of Enamel from its package.json"""
+    with open(os.path.join(os.path.dirname(os.path.abspath(__file__)), 'package.json')) as f :
+        return json.load(f)['version']
+
+def generatorsource():
+    """Return the source of this generator, the compiled module if imported"""
+    return readfile(os.path.splitext(os.path.abspath(__file__))[0] + '.py')
+
+def contenthash(*contents):
+    """Return the SHA-1 of the given strings"""
+    sha1 = hashlib.sha1()
+    for content in contents :
+        sha1.update(content if isinstance(content, bytes) else content.encode('utf-8'))
+        sha1.update(b'\0')
+    return sha1.hexdigest()
+
+def readfile(path):
+    with open(path, 'rb') as f :
+        return f.read()
 
-    # create jinja environment
-    env = Environment(loader = FileSystemLoader([os.path.join(os.path.dirname(__file__), 'templates')]), trim_blocks=True, lstrip_blocks=True)
+def writeifchanged(path, content):
+    """Write the file only if its content changes, to keep its timestamp and avoid recompiling its dependencies"""
+    if os.path.exists(path) and readfile(path) == content :
+        return False
+    with open(path, 'wb') as f :
+        f.write(content)
+    return True
 
-    # add custom filters
+def addfilters(env):
+    """Add the custom filters used by the templates"""
     env.filters['cvarname'] = cvarname
     env.filters['getid']    = getid
     env.filters['maxdictsize']  = maxdictsize
     env.filters['getdefines'] = getdefines
     env.filters['getmessagekey'] = getmessagekey
     env.filters['hashkey'] = hashkey
+    env.filters['legacyhash'] = legacyhash
     env.filters['settingscount'] = settingscount
     env.filters['getOptionArray'] = getOptionArray
     env.filters['hasStringOptions'] = hasStringOptions
+    env.filters['settings'] = getsettings
+    env.filters['sentsettings'] = sentsettings
+    env.filters['settingids'] = settingids
+    env.filters['helpercondition'] = helpercondition
+    env.filters['packedlengthsize'] = packedlengthsize
+    env.filters['getdefault'] = getdefault
+    env.filters['getreset'] = getreset
+    env.filters['getkind'] = getkind
+    env.filters['haskind'] = haskind
+    env.filters['keycount'] = keycount
+    env.filters['chunkcount'] = chunkcount
+    env.filters['chunkslots'] = chunkslots
+    env.filters['getcapacity'] = getcapacity
+    env.filters['getmaxlength'] = getmaxlength
+    env.filters['getpacktype'] = getpacktype
+    env.filters['getdictsize'] = getdictsize
+    env.filters['getfrozen'] = getfrozen
+    env.filters['getvalue'] = getvalue
+    return env
+
+_environments = {}
+
+def getenvironment(outputDir, templateshash):
+    """Return the jinja environment rendering the templates compiled in outputDir/enamel-templates-<hash>,
+    the templates are only compiled again when they change"""
+    compiledDir = os.path.join(outputDir, 'enamel-templates-' + templateshash[:12])
+    if compiledDir not in _environments :
+        if not os.path.exists(compiledDir) :
+            env = addfilters(Environment(loader = FileSystemLoader([templatesdir()]), trim_blocks=True, lstrip_blocks=True))
+            env.compile_templates(compiledDir, zip=None, ignore_errors=False)
+            # remove the templates compiled by the previous versions
+            for name in os.listdir(outputDir) :
+                if name.startswith('enamel-templates-') and os.path.join(outputDir, name) != compiledDir :
+                    shutil.rmtree(os.path.join(outputDir, name))
+        _environments[compiledDir] = addfilters(Environment(loader = ModuleLoader(compiledDir), trim_blocks=True, lstrip_blocks=True))
+    return _environments[compiledDir]
+
+def generate(configFile='src/js/config.json', outputDir='src/generated', frozenFile=None, budgetFile=None, sources=None):
+    """Generates C helpers from a Clay configuration file, frozenFile is an optional JSON object giving the constant
+    value of some settings, budgetFile an optional JSON object giving the maximum footprint on each platform,
+    sources optional C files or folders of the app : only the settings they use are generated"""
+    # create output folder
+    if not os.path.exists(outputDir):
+        os.makedirs(outputDir)
+
+    # nothing to do if the config, the templates and enamel did not change since the last generation : the messages
+    # printed by the last generation are stored after the hash in enamel.cache and printed again
+    version = getversion()
+    templateshash = contenthash(version, generatorsource(), *[readfile(os.path.join(templatesdir(), template)) for template in TEMPLATES])
+    config_raw = readfile(configFile)
+    frozen_raw = readfile(frozenFile) if frozenFile else b''
+    budget_raw = readfile(budgetFile) if budgetFile else b''
+    usage = getusage(sources) if sources else None
+    # the warnings give the location of the references : a moved reference changes the hash
+    usage_raw = json.dumps([sorted(references.items()) for references in usage.values()]).encode('utf-8') if usage else b''
+    cachehash = contenthash(templateshash, config_raw, frozen_raw, budget_raw, usage_raw)
+    cacheFile = os.path.join(outputDir, 'enamel.cache')
+    outputs = [os.path.join(outputDir, 'enamel' + ('.h' if template.endswith('h.jinja') else '.c')) for template in TEMPLATES]
+    cache = readfile(cacheFile).decode('utf-8').split('\n') if os.path.exists(cacheFile) else ['']
+    if cache[0] == cachehash and all(os.path.exists(output) for output in outputs) :
+        for message in cache[1:] :
+            print message
+        return
+
+    messages = []
+    def report(message):
+        print message
+        messages.append(message)
 
     # load config file
-    config_content=open(configFile)
+    config_content=config_raw.decode('utf-8')
     if configFile.endswith('.json') :
         # simply load the json file
-        config_content=json.load(config_content)
+        config_content=json.loads(config_content)
     else :
         # Here we have a js file from Cloudpebble
-        config_content=config_content.read()
         # Remove comments from js
         config_content=removeComments(config_content)
         # Export content of module.exports = [];
         config_content = re.findall('\s*module\.exports\s*=(.*);\s*',config_content,re.DOTALL)[0]
         config_content=json.loads(config_content)
 
-    # render templates
-    for template in ['enamel.h.jinja', 'enamel.c.jinja'] : 
-    	extension = ".h" if template.endswith('h.jinja') else ".c" 
-        f = open("%s/%s%s" % (outputDir, 'enamel', extension), 'w')
-        f.write(env.get_template(template).render({'config' : config_content}))
-        f.close()
+    if frozenFile :
+        freeze(config_content, json.loads(frozen_raw.decode('utf-8')))
+
+    if usage :
+        for warning in prune(config_content, usage) :
+            report('Enamel: warning: ' + warning)
+        # a messageKey declared in sections with exclusive capabilities is listed once
+        unused = []
+        for item, capabilities in configitems(config_content) :
+            if 'enamel-ignore' in item and getid(item) not in unused :
+                unused.append(getid(item))
+        report('Enamel: %d settings not used by the sources%s' % (len(unused), (' (' + ', '.join(unused) + ')') if unused else ''))
+
+    if not getsettings(config_content) :
+        raise EnamelError('Enamel: no setting is left to receive or persist, all of them are frozen, ignored or unused by the sources : remove Enamel from the build or keep at least one setting')
+
+    checkhashes(config_content)
+
+    checkchunks(config_content)
+
+    # the settings of sections with exclusive capabilities are never persisted together
+    persisted = max(packedsize(platformsettings(config_content, platform), packedlengthsize(config_content)) for platform in PLATFORMS)
+    raw = max(rawsize(platformsettings(config_content, platform)) for platform in PLATFORMS)
+    report('Enamel: persisted settings use at most %d bytes (%d bytes as a raw dictionary)' % (persisted, raw))
+    report('Enamel: inbox size ' + ', '.join('%s %d bytes' % (platform, inboxsize(config_content, platform)) for platform in PLATFORMS))
+
+    # footprint of the generated code, detailed in enamel.footprint.json
+    footprints = collections.OrderedDict((platform, footprint(config_content, platform)) for platform in PLATFORMS)
+    for platform, usage in footprints.iteritems() :
+        values = (platform, usage['ram'], usage['code'], usage['static'], usage['heap'], usage['persist'])
+        report('Enamel: %s uses ~%d bytes of RAM (code ~%d, static %d, heap %d), %d bytes of persistent storage' % values)
+    writeifchanged(os.path.join(outputDir, 'enamel.footprint.json'), json.dumps(footprints, indent=2).encode('utf-8'))
+    if budgetFile :
+        checkbudget(footprints, json.loads(budget_raw.decode('utf-8')))
+
+    # render templates, the unchanged files are not written
+    env = getenvironment(outputDir, templateshash)
+    for template, output in zip(TEMPLATES, outputs) :
+        writeifchanged(output, env.get_template(template).render({'config' : config_content}).encode('utf-8'))
+
+    writeifchanged(cacheFile, '\n'.join([cachehash] + messages).encode('utf-8'))
 
 def enamel(task):
-    generate(configFile=task.inputs[0].abspath(), outputDir=task.generator.bld.bldnode.abspath())
+    # the other sources are the C sources of the app, the budget (a file named *budget.json) and the frozen settings
+    sources = [node.abspath() for node in task.inputs[1:] if node.name.endswith('.c') or node.name.endswith('.h')]
+    budgets = [node.abspath() for node in task.inputs[1:] if node.name.endswith('budget.json')]
+    frozens = [node.abspath() for node in task.inputs[1:] if node.name.endswith('.json') and not node.name.endswith('budget.json')]
+    generate(configFile=task.inputs[0].abspath(), outputDir=task.generator.bld.bldnode.abspath(),
+        frozenFile=frozens[0] if frozens else None, budgetFile=budgets[0] if budgets else None, sources=sources)
 
 import argparse
 if __name__ == '__main__':
     parser = argparse.ArgumentParser(description='Generates C helpers from a Clay configuration file')
     parser.add_argument('--config', action='store', default='src/js/config.json', help='Path to Clay configuration file') 
     parser.add_argument('--folder', action='store', default='.', help='Generation folder') 
+    parser.add_argument('--frozen', action='store', default=None, help='Path to a JSON object giving the constant value of some settings')
+    parser.add_argument('--budget', action='store', default=None, help='Path to a JSON object giving the maximum footprint on each platform')
+    parser.add_argument('--sources', action='store', nargs='+', default=None, help='C files or folders of the app, only the settings they use are generated')
     result = parser.parse_args()
-    generate(configFile=result.config, outputDir=result.folder)
+    try:
+        generate(configFile=result.config, outputDir=result.folder, frozenFile=result.frozen, budgetFile=result.budget, sources=result.sources)
+    except EnamelError as e:
+        sys.exit(str(e))
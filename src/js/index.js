@@ -0,0 +1,158 @@
+/**
+ * Sends the settings returned by clay.getSettings() in several AppMessages of at most maxSize bytes.
+ * Must be used with ENAMEL_INBOX_MAX_SIZE defined to the same maxSize in the C code.
+ *
+ * sendChangedSettings only sends the settings that changed since the last settings acknowledged by the watch,
+ * with a sequence number : the watch asks for all the settings when it did not apply the previous delta,
+ * and gets the latest settings given to sendSettings or sendChangedSettings.
+ */
+var messageKeys = require('message_keys');
+
+// Last settings acknowledged by the watch and the sequence number of their message. The watch may have dropped
+// some of them (a string longer than its maxlength) : they are what was sent, not what the watch applied
+var ACKED_STORAGE_KEY = 'enamel-acked';
+// Latest settings given by the app, sent again when the watch asks for all the settings
+var LATEST_STORAGE_KEY = 'enamel-latest';
+
+var s_maxSize;
+var s_listening = false;
+
+// Size of a tuple in a Pebble Dictionary : 7 bytes header and its value
+function tupleSize(value) {
+  if (typeof value === 'string') {
+    return 7 + unescape(encodeURIComponent(value)).length + 1;
+  }
+  return 7 + 4;
+}
+
+function splitSettings(settings, maxSize) {
+  // 1 byte for the count of tuples, the count of remaining messages, the sequence number and the resync flag
+  var available = maxSize - 1 - 3 * tupleSize(0);
+  var messages = [];
+  var message = {};
+  var size = 0;
+  Object.keys(settings).forEach(function(key) {
+    var valueSize = tupleSize(settings[key]);
+    if (size > 0 && size + valueSize > available) {
+      messages.push(message);
+      message = {};
+      size = 0;
+    }
+    message[key] = settings[key];
+    size += valueSize;
+  });
+  messages.push(message);
+  // the count of remaining messages is only sent when the settings are split, as expected by the C code
+  if (messages.length > 1) {
+    messages.forEach(function(message, index) {
+      message[messageKeys.enamel_remaining] = messages.length - 1 - index;
+    });
+  }
+  return messages;
+}
+
+function loadAcked() {
+  try {
+    var acked = JSON.parse(localStorage.getItem(ACKED_STORAGE_KEY));
+    if (acked && typeof acked.sequence === 'number' && acked.settings) {
+      return acked;
+    }
+  } catch (e) {
+  }
+  return { sequence: 0, settings: {} };
+}
+
+function loadLatest() {
+  try {
+    return JSON.parse(localStorage.getItem(LATEST_STORAGE_KEY)) || {};
+  } catch (e) {
+  }
+  return {};
+}
+
+function changedSettings(settings, acked) {
+  var changed = {};
+  Object.keys(settings).forEach(function(key) {
+    if (settings[key] !== acked[key]) {
+      changed[key] = settings[key];
+    }
+  });
+  return changed;
+}
+
+function sendMessages(messages, callback) {
+  function sendNext() {
+    if (messages.length === 0) {
+      callback(null);
+      return;
+    }
+    Pebble.sendAppMessage(messages.shift(), sendNext, callback);
+  }
+  sendNext();
+}
+
+// Sends all the settings (resync) or only the changed ones, the settings are acknowledged once all the messages are sent
+function send(settings, resync, maxSize, callback) {
+  s_maxSize = maxSize;
+  listenResync();
+  localStorage.setItem(LATEST_STORAGE_KEY, JSON.stringify(settings));
+
+  var acked = loadAcked();
+  var values = resync ? settings : changedSettings(settings, acked.settings);
+  if (!resync && Object.keys(values).length === 0) {
+    if (callback) {
+      callback(null);
+    }
+    return;
+  }
+
+  // same sequence as the C code, which stores it in an int32
+  var sequence = acked.sequence % 0x7FFFFFFF + 1;
+  var messages = splitSettings(values, maxSize);
+  messages.forEach(function(message) {
+    message[messageKeys.enamel_sequence] = sequence;
+    if (resync) {
+      message[messageKeys.enamel_resync] = 1;
+    }
+  });
+
+  sendMessages(messages, function(e) {
+    if (!e) {
+      var settingsAcked = resync ? {} : acked.settings;
+      Object.keys(values).forEach(function(key) {
+        settingsAcked[key] = values[key];
+      });
+      localStorage.setItem(ACKED_STORAGE_KEY, JSON.stringify({ sequence: sequence, settings: settingsAcked }));
+    }
+    if (callback) {
+      callback(e);
+    }
+  });
+}
+
+// The watch asks for all the settings when a delta does not follow the last one it applied
+function listenResync() {
+  if (s_listening) {
+    return;
+  }
+  s_listening = true;
+  var resyncing = false;
+  Pebble.addEventListener('appmessage', function(e) {
+    var payload = e.payload || {};
+    if (resyncing || !('enamel_resync' in payload || messageKeys.enamel_resync in payload)) {
+      return;
+    }
+    resyncing = true;
+    send(loadLatest(), true, s_maxSize, function() {
+      resyncing = false;
+    });
+  });
+}
+
+module.exports.sendSettings = function(settings, maxSize, callback) {
+  send(settings, true, maxSize, callback);
+};
+
+module.exports.sendChangedSettings = function(settings, maxSize, callback) {
+  send(settings, false, maxSize, callback);
+};
@@ -0,0 +1,141 @@
+#include <pebble.h>
+#include <time.h>
+#include "enamel.h"
+#include <pebble-events/pebble-events.h>
+#include "constants.h"
+#include "bench_settings.h"
+
+// Iterations of each measure
+#define GETTER_ROUNDS 2000
+#define RECEIVE_ROUNDS 200
+#define PERSIST_ROUNDS 200
+
+#ifdef ENAMEL_LAZY_LOAD
+#define BENCH_LAZY_LOAD "true"
+#else
+#define BENCH_LAZY_LOAD "false"
+#endif
+
+// A dictionary holds at most 255 tuples
+#define TUPLES_PER_MESSAGE 255
+#define MESSAGES_COUNT ((BENCH_TUPLES_COUNT + TUPLES_PER_MESSAGE - 1) / TUPLES_PER_MESSAGE)
+
+extern uint32_t stub_persist_write_bytes;
+extern uint32_t stub_inbox_size;
+
+extern AppMessageInboxReceived stub_received_callback;
+
+// Heap allocated by enamel.c, compiled with -Dmalloc=bench_malloc -Dfree=bench_free
+static size_t s_heap;
+static size_t s_peak_heap;
+
+typedef union {
+  size_t size;
+  long double align;
+} BlockHeader;
+
+void *bench_malloc(size_t size) {
+  BlockHeader *block = malloc(sizeof(BlockHeader) + size);
+  block->size = size;
+  s_heap += size;
+  if (s_heap > s_peak_heap) {
+    s_peak_heap = s_heap;
+  }
+  return block + 1;
+}
+
+void bench_free(void *ptr) {
+  if (ptr) {
+    BlockHeader *block = (BlockHeader *)ptr - 1;
+    s_heap -= block->size;
+    free(block);
+  }
+}
+
+static double prv_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void prv_settings_received(void *context) {
+}
+
+// Messages holding all the settings, with the values of round 0 and round 1
+static DictionaryIterator s_messages[2][MESSAGES_COUNT];
+
+static void prv_write_messages() {
+  for (int32_t round = 0; round < 2; round++) {
+    for (uint16_t message = 0; message < MESSAGES_COUNT; message++) {
+      DictionaryIterator *iter = &s_messages[round][message];
+      iter->dictionary = 0;
+      uint8_t *buffer = malloc(TUPLES_PER_MESSAGE * TUPLE_SIZE);
+      dict_write_begin(iter, buffer, TUPLES_PER_MESSAGE * TUPLE_SIZE);
+      for (uint16_t tuple = message * TUPLES_PER_MESSAGE; tuple < BENCH_TUPLES_COUNT && tuple < (message + 1) * TUPLES_PER_MESSAGE; tuple++) {
+        bench_write_tuple(iter, tuple, round);
+      }
+      dict_write_end(iter);
+    }
+  }
+}
+
+static void prv_receive(int32_t round) {
+  for (uint16_t message = 0; message < MESSAGES_COUNT; message++) {
+    stub_received_callback(&s_messages[round & 1][message], NULL);
+  }
+}
+
+int main(int argc, char **argv) {
+  prv_write_messages();
+
+  double start = prv_now_ns();
+  enamel_init();
+  double init_us = (prv_now_ns() - start) / 1e3;
+  EventHandle handle = enamel_settings_received_subscribe(prv_settings_received, NULL);
+
+  volatile int32_t sum = 0;
+  start = prv_now_ns();
+  for (uint32_t i = 0; i < GETTER_ROUNDS; i++) {
+    sum += bench_read_settings();
+  }
+  double getter_ns = (prv_now_ns() - start) / ((double)GETTER_ROUNDS * BENCH_GETTER_CALLS);
+
+  // every receive changes all the settings
+  start = prv_now_ns();
+  for (int32_t round = 0; round < RECEIVE_ROUNDS; round++) {
+    prv_receive(round + 1);
+  }
+  double receive_us = (prv_now_ns() - start) / (RECEIVE_ROUNDS * 1e3);
+
+  double save_ns = 0;
+  double load_ns = 0;
+  double first_read_ns = 0;
+  for (int32_t round = 0; round < PERSIST_ROUNDS; round++) {
+    prv_receive(round);
+    stub_persist_write_bytes = 0;
+    start = prv_now_ns();
+    enamel_flush();
+    save_ns += prv_now_ns() - start;
+
+    enamel_settings_received_unsubscribe(handle);
+    enamel_deinit();
+    start = prv_now_ns();
+    enamel_init();
+    load_ns += prv_now_ns() - start;
+    handle = enamel_settings_received_subscribe(prv_settings_received, NULL);
+
+    // loads the settings with ENAMEL_LAZY_LOAD
+    start = prv_now_ns();
+    sum += bench_read_settings();
+    first_read_ns += prv_now_ns() - start;
+  }
+
+  printf("{\"version\": \"%s\", \"settings\": %d, \"lazy_load\": %s, \"getter_ns\": %.1f, \"receive_us\": %.1f, \"save_us\": %.1f, "
+    "\"load_us\": %.1f, \"first_read_us\": %.1f, \"first_init_us\": %.1f, \"peak_heap\": %zu, \"inbox_size\": %u, \"persisted_bytes\": %u}\n",
+    BENCH_VERSION, BENCH_SETTINGS_COUNT, BENCH_LAZY_LOAD, getter_ns, receive_us, save_ns / (PERSIST_ROUNDS * 1e3),
+    load_ns / (PERSIST_ROUNDS * 1e3), first_read_ns / (PERSIST_ROUNDS * 1e3), init_us, s_peak_heap, stub_inbox_size, stub_persist_write_bytes);
+
+  enamel_settings_received_unsubscribe(handle);
+  enamel_deinit();
+  return sum == 0x7FFFFFFF;
+}
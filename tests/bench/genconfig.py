@@ -0,0 +1,104 @@
+"""Generate a Clay configuration of N settings of mixed types for the benchmark, with its message_keys.auto.h
+and bench_settings.h holding the code reading all the getters and writing all the settings in a dictionary"""
+import os
+import sys
+import json
+
+# settings per section
+SECTION_SIZE = 25
+TYPES = ['toggle', 'color', 'slider', 'enum', 'string', 'checkboxgroup', 'input', 'time']
+
+def item(kind, key):
+    if kind == 'toggle' :
+        return { 'type' : 'toggle', 'messageKey' : key, 'defaultValue' : True }
+    elif kind == 'color' :
+        return { 'type' : 'color', 'messageKey' : key, 'defaultValue' : 'FF0000' }
+    elif kind == 'slider' :
+        return { 'type' : 'slider', 'messageKey' : key, 'defaultValue' : 10, 'min' : 0, 'max' : 100, 'step' : 1 }
+    elif kind == 'enum' :
+        return { 'type' : 'select', 'messageKey' : key, 'defaultValue' : '1',
+            'options' : [ { 'label' : 'One', 'value' : 1 }, { 'label' : 'Two', 'value' : 2 }, { 'label' : 'Three', 'value' : 3 } ] }
+    elif kind == 'string' :
+        return { 'type' : 'select', 'messageKey' : key, 'defaultValue' : 'red',
+            'options' : [ { 'label' : 'Red', 'value' : 'red' }, { 'label' : 'Green', 'value' : 'green' } ] }
+    elif kind == 'checkboxgroup' :
+        return { 'type' : 'checkboxgroup', 'messageKey' : key, 'defaultValue' : [True, False, True],
+            'options' : ['A', 'B', 'C'] }
+    elif kind == 'input' :
+        return { 'type' : 'input', 'messageKey' : key, 'defaultValue' : 'someone@example.com', 'attributes' : { 'maxlength' : 32 } }
+    return { 'type' : 'input', 'messageKey' : key, 'defaultValue' : '12:00', 'attributes' : { 'type' : 'time' } }
+
+def read_code(kind, key):
+    if kind == 'color' :
+        return ['enamel_get_%s().argb' % key]
+    elif kind == 'string' or kind == 'input' :
+        return ['enamel_get_%s()[0]' % key]
+    elif kind == 'checkboxgroup' :
+        return ['enamel_get_%s(%d)' % (key, i) for i in range(3)]
+    return ['(int32_t)enamel_get_%s()' % key]
+
+def write_code(kind, key):
+    if kind == 'toggle' :
+        return ['dict_write_int32(iter, MESSAGE_KEY_%s, round & 1);' % key]
+    elif kind == 'color' :
+        return ['dict_write_int32(iter, MESSAGE_KEY_%s, round & 1 ? 0x00FF00 : 0x0000FF);' % key]
+    elif kind == 'slider' :
+        return ['dict_write_int32(iter, MESSAGE_KEY_%s, round %% 100);' % key]
+    elif kind == 'enum' :
+        return ['dict_write_cstring(iter, MESSAGE_KEY_%s, round & 1 ? "2" : "3");' % key]
+    elif kind == 'string' :
+        return ['dict_write_cstring(iter, MESSAGE_KEY_%s, round & 1 ? "green" : "red");' % key]
+    elif kind == 'checkboxgroup' :
+        return ['dict_write_int32(iter, MESSAGE_KEY_%s + %d, round & 1);' % (key, i) for i in range(3)]
+    elif kind == 'input' :
+        return ['dict_write_cstring(iter, MESSAGE_KEY_%s, round & 1 ? "first@example.com" : "second@example.com");' % key]
+    return ['dict_write_cstring(iter, MESSAGE_KEY_%s, round & 1 ? "06:30" : "23:15");' % key]
+
+def generate(count, folder):
+    if not os.path.exists(folder):
+        os.makedirs(folder)
+
+    config = []
+    keys = []
+    reads = []
+    writes = []
+    messageKey = 0
+    for i in range(count) :
+        if i % SECTION_SIZE == 0 :
+            section = { 'type' : 'section', 'items' : [ { 'type' : 'heading', 'defaultValue' : 'Section %d' % (i // SECTION_SIZE) } ] }
+            config.append(section)
+        kind = TYPES[i % len(TYPES)]
+        key = 'setting_%d' % i
+        section['items'].append(item(kind, key))
+        keys.append('#define MESSAGE_KEY_%s %d' % (key, messageKey))
+        messageKey += 3 if kind == 'checkboxgroup' else 1
+        reads += read_code(kind, key)
+        writes += write_code(kind, key)
+
+    # message keys of the enamel package
+    for key in ['enamel_remaining', 'enamel_sequence', 'enamel_resync'] :
+        keys.append('#define MESSAGE_KEY_%s %d' % (key, messageKey))
+        messageKey += 1
+
+    with open(os.path.join(folder, 'config.json'), 'w') as f :
+        json.dump(config, f, indent=2)
+
+    with open(os.path.join(folder, 'message_keys.auto.h'), 'w') as f :
+        f.write('\n'.join(keys) + '\n')
+
+    with open(os.path.join(folder, 'bench_settings.h'), 'w') as f :
+        f.write('// Generated by tests/bench/genconfig.py for %d settings\n\n' % count)
+        f.write('#define BENCH_SETTINGS_COUNT %d\n' % count)
+        f.write('#define BENCH_GETTER_CALLS %d\n' % len(reads))
+        f.write('#define BENCH_TUPLES_COUNT %d\n\n' % len(writes))
+        f.write('static int32_t bench_read_settings(){\n\tint32_t sum = 0;\n')
+        f.write(''.join('\tsum += %s;\n' % read for read in reads))
+        f.write('\treturn sum;\n}\n\n')
+        f.write('// Write the tuple index of the settings, its value changes with round\n')
+        f.write('static void bench_write_tuple(DictionaryIterator *iter, uint16_t index, int32_t round){\n')
+        f.write('\tswitch(index){\n')
+        f.write(''.join('\t\tcase %d : %s break;\n' % (i, write) for i, write in enumerate(writes)))
+        f.write('\t}\n}\n')
+
+if __name__ == '__main__':
+    generate(int(sys.argv[1]), sys.argv[2])
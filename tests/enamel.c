@@ -4,25 +4,21 @@
 #include <pebble-events/pebble-events.h>
 #include "constants.h"
 
-// Colour code definitions to make the output all pretty.
-#define KNRM  "\x1B[0m"
-#define KRED  "\x1B[31m"
-#define KGRN  "\x1B[32m"
-#define KYEL  "\x1B[33m"
-#define KBLU  "\x1B[34m"
-#define KMAG  "\x1B[35m"
-#define KCYN  "\x1B[36m"
-#define KWHT  "\x1B[37m"
+extern AppMessageInboxReceived stub_received_callback;
 
-// Keep track of how many tests have run, and how many have passed.
-int tests_run = 0;
-int tests_passed = 0;
+extern uint32_t stub_dict_find_count;
+extern uint32_t stub_persist_write_count;
+extern uint32_t stub_inbox_size;
+extern uint32_t stub_outbox_sent_count;
+extern uint8_t stub_outbox_buffer[64];
+bool stub_app_timer_fire();
+void stub_persist_inject_short_write(uint32_t writes_before, uint16_t size);
 
-static AppMessageInboxReceived s_received_callback;
-
-EventHandle events_app_message_register_inbox_received(AppMessageInboxReceived received_callback, void *context){
-  s_received_callback = received_callback;
-}
+// Persist key of a chunk of settings at its slot, derived by enamel.py from the messageKeys of its section
+#define CHUNK_PKEY(slot) (3000000000u + 1 + (slot) * 16)
+// Slots of the chunks : the items outside of a section, then one per section
+static const uint16_t s_slots[] = { 3525, 2074, 3889, 3253, 1589 };
+#define SLOTS_PKEY 2999999997u
 
 static void before_each(void) {
   enamel_init();
@@ -112,7 +108,7 @@ static char* changes(void) {
   dict_write_cstring(&iterator, MESSAGE_KEY_input_time, "12:15:30");
   dict_write_end(&iterator);
 
-  s_received_callback(&iterator, NULL);
+  stub_received_callback(&iterator, NULL);
 
   mu_assert(enamel_get_enable_background() == false, "enamel_get_enable_background wrong changed value");
   mu_assert(GColorFromHEX(0xFFAA00).argb == enamel_get_background().argb, "enamel_get_background wrong changed value");
@@ -163,27 +159,720 @@ static char* load_changes(void) {
   return 0;
 }
 
+static char* getters_no_dict_find(void) {
+  printf("getters_no_dict_find\n");
+
+  stub_dict_find_count = 0;
+  for(int i=0; i<10; i++){
+    enamel_get_enable_background();
+    enamel_get_background();
+    enamel_get_font_size();
+    enamel_get_favoritefood(FAVORITEFOOD_SUSHI);
+    enamel_get_favoritefood(FAVORITEFOOD_PIZZA);
+    enamel_get_favoritefood(FAVORITEFOOD_BURGERS);
+    enamel_get_favorite_drink();
+    enamel_get_flavor();
+    enamel_get_slider();
+    enamel_get_email();
+    enamel_get_slider_nostep();
+    enamel_get_input_time();
+  }
+  mu_assert(stub_dict_find_count == 0, "getters should not call dict_find after enamel_init");
+
+  DictionaryIterator iterator;
+  iterator.dictionary = 0;
+
+  uint8_t dict_buffer[TUPLE_SIZE * 2];
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_int32(&iterator, MESSAGE_KEY_slider, 3000);
+  dict_write_end(&iterator);
+
+  stub_received_callback(&iterator, NULL);
+
+  stub_dict_find_count = 0;
+  mu_assert(3000 == enamel_get_slider(), "enamel_get_slider wrong changed value");
+  enamel_get_email();
+  enamel_get_favoritefood(FAVORITEFOOD_PIZZA);
+  mu_assert(stub_dict_find_count == 0, "getters should not call dict_find after a settings message");
+
+  return 0;
+}
+
+static char* malformed_values(void) {
+  printf("malformed_values\n");
+  DictionaryIterator iterator;
+  iterator.dictionary = 0;
+
+  uint8_t dict_buffer[TUPLE_SIZE * 4];
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_cstring(&iterator, MESSAGE_KEY_font_size, "2a");
+  dict_write_cstring(&iterator, MESSAGE_KEY_font_size_no_default, "7");
+  dict_write_cstring(&iterator, MESSAGE_KEY_input_time, "25:10");
+  dict_write_end(&iterator);
+
+  stub_received_callback(&iterator, NULL);
+
+  mu_assert(1 == enamel_get_font_size(), "enamel_get_font_size should fall back to the default value");
+  mu_assert(0 == enamel_get_font_size_no_default(), "enamel_get_font_size_no_default should fall back to the default value");
+  mu_assert((23*3600 + 56*60) == enamel_get_input_time(), "enamel_get_input_time should fall back to the default value");
+
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_cstring(&iterator, MESSAGE_KEY_font_size, "0");
+  dict_write_cstring(&iterator, MESSAGE_KEY_input_time, "07:05");
+  dict_write_end(&iterator);
+
+  stub_received_callback(&iterator, NULL);
+
+  mu_assert(0 == enamel_get_font_size(), "enamel_get_font_size wrong changed value");
+  mu_assert((7*3600 + 5*60) == enamel_get_input_time(), "enamel_get_input_time wrong changed value");
+
+  return 0;
+}
+
+static char* non_setting_message(void) {
+  printf("non_setting_message\n");
+  DictionaryIterator iterator;
+  iterator.dictionary = 0;
+
+  uint8_t dict_buffer[TUPLE_SIZE * 3];
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_int32(&iterator, 1000, 21);
+  dict_write_cstring(&iterator, 1001, "Sunny");
+  dict_write_int32(&iterator, MESSAGE_KEY_input_time + 1, 2);
+  dict_write_end(&iterator);
+
+  int32_t slider = enamel_get_slider();
+  stub_dict_find_count = 0;
+  stub_received_callback(&iterator, NULL);
+
+  mu_assert(stub_dict_find_count == 0, "a non setting message should be rejected in a single pass");
+  mu_assert(slider == enamel_get_slider(), "a non setting message should not change the settings");
+
+  return 0;
+}
+
+static char* stable_hashes(void) {
+  printf("stable_hashes\n");
+  mu_assert(enamel_hash("") == 0x811C9DC5, "enamel_hash wrong offset basis");
+  mu_assert(enamel_hash("a") == 0xE40C292C, "enamel_hash wrong FNV-1a value");
+  mu_assert(enamel_hash("enable_background") == ENAMEL_HASH_ENABLE_BACKGROUND, "ENAMEL_HASH_ENABLE_BACKGROUND differs from enamel_hash");
+  mu_assert(enamel_hash("favoritefood[3]") == ENAMEL_HASH_FAVORITEFOOD, "ENAMEL_HASH_FAVORITEFOOD differs from enamel_hash");
+  return 0;
+}
+
+static char* incremental_save(void) {
+  printf("incremental_save\n");
+  DictionaryIterator iterator;
+  iterator.dictionary = 0;
+
+  uint8_t dict_buffer[TUPLE_SIZE * 2];
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_int32(&iterator, MESSAGE_KEY_enable_background, !enamel_get_enable_background());
+  dict_write_cstring(&iterator, MESSAGE_KEY_email, enamel_get_email());
+  dict_write_end(&iterator);
+
+  stub_received_callback(&iterator, NULL);
+
+  stub_persist_write_count = 0;
+  enamel_deinit();
+  mu_assert(stub_persist_write_count == 1, "only the chunk of the first section should be written");
+  enamel_init();
+
+  stub_received_callback(&iterator, NULL);
+
+  stub_persist_write_count = 0;
+  enamel_deinit();
+  mu_assert(stub_persist_write_count == 0, "unchanged settings should not be written");
+  enamel_init();
+
+  return 0;
+}
+
+static char* corrupted_chunk(void) {
+  printf("corrupted_chunk\n");
+  DictionaryIterator iterator;
+  iterator.dictionary = 0;
+
+  uint8_t dict_buffer[TUPLE_SIZE * 2];
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_int32(&iterator, MESSAGE_KEY_slider, 42);
+  dict_write_cstring(&iterator, MESSAGE_KEY_email, "keep me");
+  dict_write_end(&iterator);
+
+  stub_received_callback(&iterator, NULL);
+  enamel_deinit();
+
+  uint8_t data[PERSIST_DATA_MAX_LENGTH];
+  int length = persist_read_data(CHUNK_PKEY(s_slots[1]), data, sizeof(data));
+  mu_assert(length > 12, "the chunk of the first section should be persisted");
+  data[10] ^= 0xFF;
+  persist_write_data(CHUNK_PKEY(s_slots[1]), data, length);
+
+  enamel_init();
+  mu_assert(1500 == enamel_get_slider(), "a corrupted chunk should be rolled back to the defaults");
+  mu_assert(enamel_get_enable_background(), "a corrupted chunk should be rolled back to the defaults");
+  mu_assert(strcmp("keep me", enamel_get_email()) == 0, "the other chunks should be loaded");
+
+  return 0;
+}
+
+static char* packed_chunk(void) {
+  printf("packed_chunk\n");
+  DictionaryIterator iterator;
+  iterator.dictionary = 0;
+
+  uint8_t dict_buffer[TUPLE_SIZE * 2];
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_cstring(&iterator, MESSAGE_KEY_email, "a@b");
+  dict_write_cstring(&iterator, MESSAGE_KEY_email_no_default, "");
+  dict_write_end(&iterator);
+
+  stub_received_callback(&iterator, NULL);
+  enamel_deinit();
+
+  // header (9) + "a@b" (2 + 3) + "" (2) + signature "" (2) + input_time (4) + checksum (4), the lengths use 2 bytes
+  // as signature can hold more than 255 bytes
+  uint8_t data[PERSIST_DATA_MAX_LENGTH];
+  mu_assert(persist_read_data(CHUNK_PKEY(s_slots[2]), data, sizeof(data)) == 26, "strings should be stored with their length only");
+
+  enamel_init();
+  mu_assert(strcmp("a@b", enamel_get_email()) == 0, "packed string should be loaded");
+  mu_assert(strcmp("", enamel_get_email_no_default()) == 0, "packed empty string should be loaded");
+
+  // 80 characters of 4 bytes in UTF-8 : 320 bytes, over the 255 of a 1 byte length
+  char signature[4 * 80 + 1] = "";
+  for(int i = 0; i < 80; i++) {
+    strcat(signature, "\xF0\x9F\x98\x80");
+  }
+  uint8_t long_buffer[TUPLE_SIZE + sizeof(signature)];
+  dict_write_begin(&iterator, long_buffer, sizeof(long_buffer));
+  dict_write_cstring(&iterator, MESSAGE_KEY_signature, signature);
+  dict_write_end(&iterator);
+  stub_received_callback(&iterator, NULL);
+  mu_assert(strcmp(signature, enamel_get_signature()) == 0, "string longer than 255 bytes should be applied");
+
+  enamel_deinit();
+  enamel_init();
+  mu_assert(strcmp(signature, enamel_get_signature()) == 0, "string longer than 255 bytes should be reloaded whole");
+
+  // a previous version of the chunk used 3 keys, the chunk now fits in 1
+  uint8_t stale[PERSIST_DATA_MAX_LENGTH] = { 0 };
+  persist_write_data(CHUNK_PKEY(s_slots[2]) + 2, stale, sizeof(stale));
+  dict_write_begin(&iterator, long_buffer, sizeof(long_buffer));
+  dict_write_cstring(&iterator, MESSAGE_KEY_signature, "");
+  dict_write_end(&iterator);
+  stub_received_callback(&iterator, NULL);
+  enamel_flush();
+  mu_assert(persist_exists(CHUNK_PKEY(s_slots[2])), "the chunk should be saved");
+  mu_assert(!persist_exists(CHUNK_PKEY(s_slots[2]) + 1) && !persist_exists(CHUNK_PKEY(s_slots[2]) + 2), "the keys of a longer previous chunk should be deleted");
+
+  return 0;
+}
+
+static char* moved_chunk(void) {
+  printf("moved_chunk\n");
+  DictionaryIterator iterator;
+  iterator.dictionary = 0;
+
+  uint8_t dict_buffer[TUPLE_SIZE];
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_cstring(&iterator, MESSAGE_KEY_email, "stay@test.fr");
+  dict_write_end(&iterator);
+  stub_received_callback(&iterator, NULL);
+  enamel_deinit();
+
+  // a previous configuration saved the chunk of the second section at the slot 7, on two keys
+  uint16_t slots[sizeof(s_slots) / sizeof(s_slots[0])];
+  memcpy(slots, s_slots, sizeof(slots));
+  slots[2] = 7;
+  persist_write_data(SLOTS_PKEY, slots, sizeof(slots));
+  uint8_t data[PERSIST_DATA_MAX_LENGTH] = { 0 };
+  persist_write_data(CHUNK_PKEY(7), data, sizeof(data));
+  persist_write_data(CHUNK_PKEY(7) + 1, data, 10);
+
+  enamel_init();
+  mu_assert(!persist_exists(CHUNK_PKEY(7)) && !persist_exists(CHUNK_PKEY(7) + 1), "the keys of a chunk moved to another slot should be deleted");
+  mu_assert(strcmp("stay@test.fr", enamel_get_email()) == 0, "the chunks at their slot should be loaded");
+
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_int32(&iterator, MESSAGE_KEY_slider, 7);
+  dict_write_end(&iterator);
+  stub_received_callback(&iterator, NULL);
+  enamel_flush();
+  mu_assert(persist_read_data(SLOTS_PKEY, slots, sizeof(slots)) == sizeof(slots) && memcmp(slots, s_slots, sizeof(slots)) == 0, "the slots of the chunks should be saved");
+
+  return 0;
+}
+
+static uint32_t s_dropped_key;
+
+static void settings_dropped(uint32_t key, void *context) {
+  s_dropped_key = key;
+}
+
+static char* input_maxlength(void) {
+  printf("input_maxlength\n");
+  enamel_register_settings_dropped(settings_dropped, NULL);
+  s_dropped_key = 0;
+
+  DictionaryIterator iterator;
+  iterator.dictionary = 0;
+
+  uint8_t dict_buffer[TUPLE_SIZE * 2];
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_int32(&iterator, MESSAGE_KEY_slider_no_default, 12);
+  dict_write_cstring(&iterator, MESSAGE_KEY_email_no_default, "0123456789abcdefghij");
+  dict_write_end(&iterator);
+
+  stub_received_callback(&iterator, NULL);
+  mu_assert(s_dropped_key == MESSAGE_KEY_email_no_default, "input longer than its maxlength should be reported");
+  mu_assert(strcmp("", enamel_get_email_no_default()) == 0, "input longer than its maxlength should not be applied");
+  mu_assert(12 == enamel_get_slider_no_default(), "the other settings of a message with a value that does not fit should be applied");
+
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_cstring(&iterator, MESSAGE_KEY_email_no_default, "0123456789abcdef");
+  dict_write_end(&iterator);
+
+  stub_received_callback(&iterator, NULL);
+  mu_assert(strcmp("0123456789abcdef", enamel_get_email_no_default()) == 0, "input of maxlength should be applied");
+
+  // maxlength counts characters : 16 accented characters use 32 bytes of UTF-8
+  const char *accented = "\xC3\xA9\xC3\xA9\xC3\xA9\xC3\xA9\xC3\xA9\xC3\xA9\xC3\xA9\xC3\xA9\xC3\xA9\xC3\xA9\xC3\xA9\xC3\xA9\xC3\xA9\xC3\xA9\xC3\xA9\xC3\xA9";
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_cstring(&iterator, MESSAGE_KEY_email_no_default, accented);
+  dict_write_end(&iterator);
+
+  s_dropped_key = 0;
+  stub_received_callback(&iterator, NULL);
+  mu_assert(s_dropped_key == 0, "non-ASCII input of maxlength characters should not be dropped");
+  mu_assert(strcmp(accented, enamel_get_email_no_default()) == 0, "non-ASCII input of maxlength characters should be applied");
+
+  enamel_register_settings_dropped(NULL, NULL);
+  return 0;
+}
+
+static uint32_t s_received_count;
+
+static void settings_received(void *context) {
+  s_received_count++;
+}
+
+static char* split_messages(void) {
+  printf("split_messages\n");
+  mu_assert(stub_inbox_size == 400, "inbox should be limited to ENAMEL_INBOX_MAX_SIZE");
+
+  EventHandle handle = enamel_settings_received_subscribe(settings_received, NULL);
+  s_received_count = 0;
+
+  DictionaryIterator iterator;
+  iterator.dictionary = 0;
+  uint8_t dict_buffer[TUPLE_SIZE * 2];
+
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_int32(&iterator, MESSAGE_KEY_slider, 7);
+  dict_write_int32(&iterator, MESSAGE_KEY_enamel_remaining, 1);
+  dict_write_end(&iterator);
+  stub_received_callback(&iterator, NULL);
+  mu_assert(7 == enamel_get_slider(), "first message should be applied");
+  mu_assert(s_received_count == 0, "subscribers should wait for the last message");
+
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_int32(&iterator, MESSAGE_KEY_slider_nostep, 3);
+  dict_write_int32(&iterator, MESSAGE_KEY_enamel_remaining, 0);
+  dict_write_end(&iterator);
+  stub_received_callback(&iterator, NULL);
+  mu_assert(3 == enamel_get_slider_nostep(), "last message should be applied");
+  mu_assert(s_received_count == 1, "subscribers should be notified after the last message");
+
+  enamel_settings_received_unsubscribe(handle);
+  return 0;
+}
+
+static EnamelSettingsMask s_changed_settings;
+
+static void settings_changed(const EnamelSettingsMask *changed, void *context) {
+  s_received_count++;
+  s_changed_settings = *changed;
+}
+
+static char* changed_mask(void) {
+  printf("changed_mask\n");
+  EnamelSettingsMask mask = { { 0 } };
+  enamel_mask_add(&mask, ENAMEL_SETTING_SLIDER);
+  enamel_mask_add(&mask, ENAMEL_SETTING_INPUT_TIME);
+  EventHandle handle = enamel_settings_changed_subscribe(settings_changed, &mask, NULL);
+  s_received_count = 0;
+
+  DictionaryIterator iterator;
+  iterator.dictionary = 0;
+  uint8_t dict_buffer[TUPLE_SIZE * 2];
+
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_int32(&iterator, MESSAGE_KEY_slider, enamel_get_slider());
+  dict_write_cstring(&iterator, MESSAGE_KEY_email, "changed@test.fr");
+  dict_write_end(&iterator);
+  stub_received_callback(&iterator, NULL);
+  mu_assert(s_received_count == 0, "handler should not be called when its settings do not change");
+
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_int32(&iterator, MESSAGE_KEY_slider, enamel_get_slider() + 1);
+  dict_write_cstring(&iterator, MESSAGE_KEY_email, "other@test.fr");
+  dict_write_end(&iterator);
+  stub_received_callback(&iterator, NULL);
+  mu_assert(s_received_count == 1, "handler should be called when one of its settings changes");
+  mu_assert(enamel_mask_contains(&s_changed_settings, ENAMEL_SETTING_SLIDER), "changed settings should contain the slider");
+  mu_assert(enamel_mask_contains(&s_changed_settings, ENAMEL_SETTING_EMAIL), "changed settings should contain the email");
+  mu_assert(!enamel_mask_contains(&s_changed_settings, ENAMEL_SETTING_INPUT_TIME), "changed settings should not contain unchanged settings");
+
+  enamel_settings_received_unsubscribe(handle);
+  return 0;
+}
+
+static char* write_behind(void) {
+  printf("write_behind\n");
+  DictionaryIterator iterator;
+  iterator.dictionary = 0;
+  uint8_t dict_buffer[TUPLE_SIZE];
+
+  stub_persist_write_count = 0;
+  for(int32_t i = 0; i < 5; i++){
+    dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+    dict_write_int32(&iterator, MESSAGE_KEY_slider, 100 + i);
+    dict_write_end(&iterator);
+    stub_received_callback(&iterator, NULL);
+  }
+  mu_assert(stub_persist_write_count == 0, "settings should not be saved before the delay");
+  mu_assert(stub_app_timer_fire(), "a save should be scheduled");
+  mu_assert(stub_persist_write_count == 1, "the burst of changes should be saved once");
+  mu_assert(!stub_app_timer_fire(), "no other save should be scheduled");
+
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_int32(&iterator, MESSAGE_KEY_slider, 42);
+  dict_write_end(&iterator);
+  stub_received_callback(&iterator, NULL);
+
+  stub_persist_write_count = 0;
+  enamel_flush();
+  mu_assert(stub_persist_write_count == 1, "enamel_flush should save the changes");
+  mu_assert(!stub_app_timer_fire(), "enamel_flush should cancel the scheduled save");
+
+  stub_persist_write_count = 0;
+  enamel_deinit();
+  mu_assert(stub_persist_write_count == 0, "flushed settings should not be saved again");
+  enamel_init();
+  mu_assert(42 == enamel_get_slider(), "flushed settings should be loaded");
+
+  return 0;
+}
+
+static char* short_write(void) {
+  printf("short_write\n");
+  DictionaryIterator iterator;
+  iterator.dictionary = 0;
+
+  uint8_t dict_buffer[TUPLE_SIZE * 2];
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_int32(&iterator, MESSAGE_KEY_slider, 77);
+  dict_write_cstring(&iterator, MESSAGE_KEY_email, "short@write.fr");
+  dict_write_end(&iterator);
+  stub_received_callback(&iterator, NULL);
+
+  // the chunk of the first section is written, the chunk of the second one is cut
+  stub_persist_inject_short_write(1, 10);
+  enamel_deinit();
+  enamel_init();
+  mu_assert(77 == enamel_get_slider(), "the complete chunk should be loaded");
+  mu_assert(strcmp("gregoire@test.fr", enamel_get_email()) == 0, "the cut chunk should be rolled back to the defaults");
+
+  return 0;
+}
+
+static char* inline_getters(void) {
+  printf("inline_getters\n");
+  DictionaryIterator iterator;
+  iterator.dictionary = 0;
+
+  uint8_t dict_buffer[TUPLE_SIZE];
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_int32(&iterator, MESSAGE_KEY_slider_nostep, 321);
+  dict_write_end(&iterator);
+  stub_received_callback(&iterator, NULL);
+
+  // slider_nostep is "enamel-inline" : its getter reads enamel_settings in the header
+  mu_assert(321 == enamel_get_slider_nostep(), "the inline getter should return the received value");
+  mu_assert(enamel_settings.slider_nostep == enamel_get_slider_nostep(), "the inline getter should read enamel_settings");
+
+  return 0;
+}
+
+static char* snapshot(void) {
+  printf("snapshot\n");
+  DictionaryIterator iterator;
+  iterator.dictionary = 0;
+
+  EnamelSettings settings;
+  enamel_snapshot(&settings);
+  mu_assert(settings.slider == enamel_get_slider(), "snapshot should hold the current values");
+  mu_assert(strcmp(enamel_get_email(), settings.email) == 0, "snapshot should hold the current strings");
+  mu_assert(settings.favoritefood[FAVORITEFOOD_PIZZA] == enamel_get_favoritefood(FAVORITEFOOD_PIZZA), "snapshot should hold the current checkboxgroup");
+  const int32_t slider = settings.slider;
+
+  uint8_t dict_buffer[TUPLE_SIZE * 2];
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_int32(&iterator, MESSAGE_KEY_slider, 9);
+  dict_write_cstring(&iterator, MESSAGE_KEY_email, "snap@shot.fr");
+  dict_write_end(&iterator);
+  stub_received_callback(&iterator, NULL);
+
+  mu_assert(settings.slider == slider, "snapshot should not follow the received settings");
+  enamel_snapshot(&settings);
+  mu_assert(settings.slider == enamel_get_slider(), "snapshot should hold the received values");
+  mu_assert(strcmp(enamel_get_email(), settings.email) == 0, "snapshot should hold the received strings");
+
+  return 0;
+}
+
+// default ENAMEL_MAX_SUBSCRIBERS
+#define MAX_SUBSCRIBERS 8
+
+static EventHandle s_handles[3];
+static uint32_t s_handler_calls[3];
+
+// handler 0 unsubscribes itself and handler 1, then subscribes handler 2
+static void unsubscribing_handler(void *context) {
+  s_handler_calls[0]++;
+  enamel_settings_received_unsubscribe(s_handles[0]);
+  enamel_settings_received_unsubscribe(s_handles[1]);
+  s_handles[2] = enamel_settings_received_subscribe(settings_received, NULL);
+}
+
+static void unsubscribed_handler(void *context) {
+  s_handler_calls[1]++;
+}
+
+static char* subscribers_table(void) {
+  printf("subscribers_table\n");
+  DictionaryIterator iterator;
+  iterator.dictionary = 0;
+  uint8_t dict_buffer[TUPLE_SIZE];
+
+  s_received_count = 0;
+  s_handles[0] = enamel_settings_received_subscribe(unsubscribing_handler, NULL);
+  s_handles[1] = enamel_settings_received_subscribe(unsubscribed_handler, NULL);
+  mu_assert(s_handles[0] && s_handles[1] && s_handles[0] != s_handles[1], "subscribe should return distinct handles");
+
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_int32(&iterator, MESSAGE_KEY_slider, 11);
+  dict_write_end(&iterator);
+  stub_received_callback(&iterator, NULL);
+  mu_assert(s_handler_calls[0] == 1, "first handler should be called");
+  mu_assert(s_handler_calls[1] == 0, "handler unsubscribed during the dispatch should not be called");
+  mu_assert(s_received_count == 0, "handler subscribed during the dispatch should wait for the next one");
+
+  stub_received_callback(&iterator, NULL);
+  mu_assert(s_handler_calls[0] == 1 && s_handler_calls[1] == 0, "unsubscribed handlers should not be called");
+  mu_assert(s_received_count == 1, "handler subscribed during the previous dispatch should be called");
+
+  // the slot of handler 0 is reused by handler 2 : the old handle is stale
+  enamel_settings_received_unsubscribe(s_handles[0]);
+  stub_received_callback(&iterator, NULL);
+  mu_assert(s_received_count == 2, "stale handle should not unsubscribe the new handler");
+  enamel_settings_received_unsubscribe(s_handles[2]);
+
+  EventHandle handles[MAX_SUBSCRIBERS];
+  for(int i = 0; i < MAX_SUBSCRIBERS; i++) {
+    handles[i] = enamel_settings_received_subscribe(settings_received, NULL);
+    mu_assert(handles[i], "subscribe should succeed until the table is full");
+  }
+  mu_assert(!enamel_settings_received_subscribe(settings_received, NULL), "subscribe should fail when the table is full");
+  for(int i = 0; i < MAX_SUBSCRIBERS; i++) {
+    enamel_settings_received_unsubscribe(handles[i]);
+  }
+
+  s_received_count = 0;
+  stub_received_callback(&iterator, NULL);
+  mu_assert(s_received_count == 0, "all the handlers should be unsubscribed");
+  return 0;
+}
+
+static void send_delta(int32_t slider, int32_t sequence, bool resync) {
+  DictionaryIterator iterator;
+  iterator.dictionary = 0;
+  uint8_t dict_buffer[TUPLE_SIZE * 3];
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_int32(&iterator, MESSAGE_KEY_slider, slider);
+  dict_write_int32(&iterator, MESSAGE_KEY_enamel_sequence, sequence);
+  if(resync) {
+    dict_write_int32(&iterator, MESSAGE_KEY_enamel_resync, 1);
+  }
+  dict_write_end(&iterator);
+  stub_received_callback(&iterator, NULL);
+}
+
+static char* delta_sequence(void) {
+  printf("delta_sequence\n");
+  send_delta(21, 5, true);
+  mu_assert(21 == enamel_get_slider(), "full settings should be applied whatever their sequence");
+  send_delta(22, 6, false);
+  mu_assert(22 == enamel_get_slider(), "delta following the last one should be applied");
+
+  stub_outbox_sent_count = 0;
+  send_delta(23, 8, false);
+  mu_assert(22 == enamel_get_slider(), "delta not following the last one should be dropped");
+  mu_assert(stub_outbox_sent_count == 1, "a resync should be requested");
+  DictionaryIterator iterator;
+  dict_read_begin_from_buffer(&iterator, stub_outbox_buffer, sizeof(stub_outbox_buffer));
+  Tuple *tuple = dict_find(&iterator, MESSAGE_KEY_enamel_resync);
+  mu_assert(tuple && tuple->value->int32 == 6, "resync request should hold the last sequence applied");
+
+  enamel_deinit();
+  enamel_init();
+  send_delta(24, 7, false);
+  mu_assert(24 == enamel_get_slider(), "sequence should be persisted");
+  mu_assert(stub_outbox_sent_count == 1, "no other resync should be requested");
+
+  // the settings sent again hold a value that does not fit : only this value is dropped, the message consumes its sequence
+  uint8_t dict_buffer[TUPLE_SIZE * 4];
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_int32(&iterator, MESSAGE_KEY_slider, 10);
+  dict_write_cstring(&iterator, MESSAGE_KEY_email_no_default, "0123456789abcdefghij");
+  dict_write_int32(&iterator, MESSAGE_KEY_enamel_sequence, 8);
+  dict_write_int32(&iterator, MESSAGE_KEY_enamel_resync, 1);
+  dict_write_end(&iterator);
+  stub_received_callback(&iterator, NULL);
+  mu_assert(10 == enamel_get_slider(), "the settings of a message with a value that does not fit should be applied");
+  mu_assert(strcmp("", enamel_get_email_no_default()) == 0, "a value that does not fit should be dropped");
+  send_delta(25, 9, false);
+  mu_assert(25 == enamel_get_slider(), "delta following a dropped value should be applied");
+  mu_assert(stub_outbox_sent_count == 1, "a dropped value should not lead to a resync");
+
+  return 0;
+}
+
+static char* stats(void) {
+  printf("stats\n");
+  DictionaryIterator iterator;
+  iterator.dictionary = 0;
+  uint8_t dict_buffer[TUPLE_SIZE * 3];
+  EnamelStats stats;
+
+  enamel_reset_stats();
+  for(int i = 0; i < 3; i++){
+    enamel_get_slider();
+  }
+  enamel_get_favoritefood(FAVORITEFOOD_PIZZA);
+  enamel_get_slider_nostep();
+  enamel_get_stats(&stats);
+  mu_assert(stats.getter_calls[ENAMEL_SETTING_SLIDER] == 3, "getter calls should be counted per setting");
+  mu_assert(stats.getter_calls[ENAMEL_SETTING_FAVORITEFOOD] == 1, "checkboxgroup getter calls should be counted");
+  mu_assert(stats.getter_calls[ENAMEL_SETTING_SLIDER_NOSTEP] == 1, "inline getter calls should be counted");
+  mu_assert(stats.getter_calls[ENAMEL_SETTING_EMAIL] == 0, "getters not called should not be counted");
+  mu_assert(stats.tuples_scanned == 0, "getters should not scan any tuple");
+
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_int32(&iterator, 1000, 21);
+  dict_write_cstring(&iterator, 1001, "Sunny");
+  dict_write_int32(&iterator, MESSAGE_KEY_input_time + 1, 2);
+  dict_write_end(&iterator);
+  stub_received_callback(&iterator, NULL);
+  enamel_get_stats(&stats);
+  mu_assert(stats.messages_rejected == 1 && stats.messages_accepted == 0, "a non setting message should be rejected");
+  mu_assert(stats.tuples_scanned == 3, "a non setting message should be scanned once");
+
+  enamel_reset_stats();
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_int32(&iterator, MESSAGE_KEY_slider, 1234);
+  dict_write_cstring(&iterator, MESSAGE_KEY_email, "stats@test.fr");
+  dict_write_end(&iterator);
+  stub_received_callback(&iterator, NULL);
+  enamel_get_stats(&stats);
+  mu_assert(stats.messages_accepted == 1 && stats.messages_rejected == 0, "a settings message should be accepted");
+  mu_assert(stats.tuples_scanned <= 3 * 2, "a settings message should be read at most 3 times");
+  mu_assert(stats.persist_writes == 0, "settings should not be saved before the delay");
+
+  stub_persist_write_count = 0;
+  enamel_flush();
+  enamel_get_stats(&stats);
+  mu_assert(stats.persist_writes == stub_persist_write_count, "persist writes should be counted");
+  mu_assert(stats.persist_writes == 2, "only the chunks of the changed settings should be written");
+  mu_assert(stats.persist_bytes > 0 && stats.persist_bytes <= 2 * PERSIST_DATA_MAX_LENGTH, "persisted bytes should be counted");
+
+  EventHandle handle = enamel_settings_received_subscribe(settings_received, NULL);
+  enamel_reset_stats();
+  enamel_get_stats(&stats);
+  mu_assert(stats.getter_calls[ENAMEL_SETTING_SLIDER] == 0 && stats.tuples_scanned == 0 && stats.persist_bytes == 0, "enamel_reset_stats should reset the counters");
+  mu_assert(stats.inbox_size == stub_inbox_size, "the inbox size should be reported");
+  mu_assert(stats.subscribers == 1, "the subscribed handlers should be reported");
+  enamel_settings_received_unsubscribe(handle);
+  enamel_get_stats(&stats);
+  mu_assert(stats.subscribers == 0, "the unsubscribed handlers should not be reported");
+
+  return 0;
+}
+
+static char* legacy_settings(void) {
+  printf("legacy_settings\n");
+  enamel_deinit();
+  // only the Dictionary saved by a previous version of Enamel is left, keyed by the Python hash of the message keys
+  for(uint32_t i = 0; i < sizeof(s_slots) / sizeof(s_slots[0]); i++) {
+    for(uint32_t key = CHUNK_PKEY(s_slots[i]); key < CHUNK_PKEY(s_slots[i] + 1); key++) {
+      persist_delete(key);
+    }
+  }
+  DictionaryIterator iterator;
+  iterator.dictionary = 0;
+  uint8_t dict_buffer[TUPLE_SIZE * 3];
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_int32(&iterator, 0x76d6fb51, 321);
+  dict_write_cstring(&iterator, 0x37609cbd, "legacy@test.fr");
+  dict_write_int32(&iterator, 0x6337f484 + FAVORITEFOOD_PIZZA, 1);
+  uint32_t size = dict_write_end(&iterator);
+  persist_write_int(3000000000u, size);
+  persist_write_data(3000000001u, dict_buffer, size);
+
+  enamel_init();
+  mu_assert(321 == enamel_get_slider(), "legacy slider should be migrated");
+  mu_assert(strcmp("legacy@test.fr", enamel_get_email()) == 0, "legacy string should be migrated");
+  mu_assert(enamel_get_favoritefood(FAVORITEFOOD_PIZZA), "legacy checkboxgroup option should be migrated");
+  mu_assert(enamel_get_favoritefood(FAVORITEFOOD_SUSHI), "settings missing from the legacy dictionary should keep their default");
+  mu_assert(!persist_exists(3000000000u), "legacy settings should only be read once");
+
+  enamel_deinit();
+  enamel_init();
+  mu_assert(321 == enamel_get_slider(), "migrated settings should be saved as chunks");
+  mu_assert(strcmp("legacy@test.fr", enamel_get_email()) == 0, "migrated settings should be saved as chunks");
+
+  return 0;
+}
+
 static char* all_tests(void) {
   mu_run_test(default_values);
   mu_run_test(save_load_no_change);
   mu_run_test(changes);
   mu_run_test(load_changes);
+  mu_run_test(getters_no_dict_find);
+  mu_run_test(malformed_values);
+  mu_run_test(non_setting_message);
+  mu_run_test(stable_hashes);
+  mu_run_test(incremental_save);
+  mu_run_test(corrupted_chunk);
+  mu_run_test(packed_chunk);
+  mu_run_test(moved_chunk);
+  mu_run_test(input_maxlength);
+  mu_run_test(split_messages);
+  mu_run_test(changed_mask);
+  mu_run_test(write_behind);
+  mu_run_test(short_write);
+  mu_run_test(inline_getters);
+  mu_run_test(snapshot);
+  mu_run_test(subscribers_table);
+  mu_run_test(delta_sequence);
+  mu_run_test(stats);
+  mu_run_test(legacy_settings);
   return 0;
 }
 
 // Test application entry point.
-// Executes all the tests and prints the results in pretty colours.
 int main(int argc, char **argv) {
-  printf("%s------------------------\n", KCYN);
-  printf("| Running Enamel Tests |\n");
-  printf("------------------------\n%s", KNRM);
-  char* result = all_tests();
-  if (0 != result) {
-    printf("%s- Failed Test:%s %s\n", KRED, KNRM, result);
-  }
-  printf("- Tests Run: %s%d%s\n", (tests_run == tests_passed) ? KGRN : KRED, tests_run, KNRM);
-  printf("- Tests Passed: %s%d%s\n", (tests_run == tests_passed) ? KGRN : KRED, tests_passed, KNRM);
-
-  printf("%s------------------------%s\n", KCYN, KNRM);
-  return result != 0;
-}
\ No newline at end of file
+  return unit_main("Running Enamel Tests", all_tests);
+}
@@ -0,0 +1,89 @@
+#include <pebble.h>
+#include "unit.h"
+#include "enamel.h"
+#include <pebble-events/pebble-events.h>
+#include "constants.h"
+
+// Tests of the helpers generated with --frozen tests/frozen.json
+
+extern AppMessageInboxReceived stub_received_callback;
+
+extern uint32_t stub_inbox_size;
+
+static void before_each(void) {
+  enamel_init();
+}
+
+static void after_each(void) {
+  enamel_deinit();
+}
+
+static char* frozen_values(void) {
+  printf("frozen_values\n");
+  mu_assert(!enamel_get_enable_background(), "enamel_get_enable_background wrong frozen value");
+  mu_assert(GColorFromHEX(0x00FF00).argb == enamel_get_background().argb, "enamel_get_background wrong frozen value");
+  mu_assert(FONT_SIZE_LARGE == enamel_get_font_size(), "enamel_get_font_size wrong frozen value");
+  mu_assert(!enamel_get_favoritefood(FAVORITEFOOD_SUSHI), "enamel_get_favoritefood FAVORITEFOOD_SUSHI wrong frozen value");
+  mu_assert(enamel_get_favoritefood(FAVORITEFOOD_PIZZA), "enamel_get_favoritefood FAVORITEFOOD_PIZZA wrong frozen value");
+  mu_assert(!enamel_get_favoritefood(FAVORITEFOOD_BURGERS), "enamel_get_favoritefood FAVORITEFOOD_BURGERS wrong frozen value");
+  mu_assert(strcmp("banana", enamel_get_flavor()) == 0, "enamel_get_flavor wrong frozen value");
+  mu_assert(2000 == enamel_get_slider(), "enamel_get_slider wrong frozen value");
+  mu_assert(strcmp("frozen@test.fr", enamel_get_email()) == 0, "enamel_get_email wrong frozen value");
+  mu_assert((6*3600 + 30*60) == enamel_get_input_time(), "enamel_get_input_time wrong frozen value");
+  // fg is declared in the COLOR and BW sections, both declarations are frozen
+#ifdef ENAMEL_HASH_FG
+  mu_assert(false, "every declaration of a frozen messageKey should be frozen");
+#endif
+  mu_assert(GColorFromHEX(0xFF00FF).argb == enamel_get_fg().argb, "enamel_get_fg wrong frozen value");
+
+  mu_assert(strcmp("coca", enamel_get_favorite_drink()) == 0, "enamel_get_favorite_drink wrong default value");
+  mu_assert(125 == enamel_get_slider_nostep(), "enamel_get_slider_nostep wrong default value");
+  return 0;
+}
+
+static char* frozen_not_received(void) {
+  printf("frozen_not_received\n");
+  // inbox of the settings which are not frozen, the frozen settings still sent by Clay (226 bytes), the sequence
+  // number and the resync flag
+  mu_assert(stub_inbox_size == 152 + (7 + 321) + 226 + 2 * (7 + 4), "frozen settings sent by Clay should be counted in the inbox");
+
+  DictionaryIterator iterator;
+  uint8_t dict_buffer[TUPLE_SIZE * 3];
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_int32(&iterator, MESSAGE_KEY_slider, 5);
+  dict_write_cstring(&iterator, MESSAGE_KEY_email, "changed@test.fr");
+  dict_write_int32(&iterator, MESSAGE_KEY_slider_nostep, 7);
+  dict_write_end(&iterator);
+  stub_received_callback(&iterator, NULL);
+
+  mu_assert(2000 == enamel_get_slider(), "frozen slider should not change");
+  mu_assert(strcmp("frozen@test.fr", enamel_get_email()) == 0, "frozen email should not change");
+  mu_assert(7 == enamel_get_slider_nostep(), "settings which are not frozen should change");
+
+  enamel_deinit();
+  enamel_init();
+  mu_assert(7 == enamel_get_slider_nostep(), "settings which are not frozen should be persisted");
+  return 0;
+}
+
+static char* lazy_load(void) {
+  printf("lazy_load\n");
+  mu_assert(!enamel_settings_loaded, "enamel_init should not load the settings");
+  mu_assert(FONT_SIZE_LARGE == enamel_get_font_size(), "frozen getters should not load the settings");
+  mu_assert(!enamel_settings_loaded, "frozen getters should not load the settings");
+  mu_assert(7 == enamel_get_slider_nostep(), "first getter should load the settings");
+  mu_assert(enamel_settings_loaded, "first getter should load the settings");
+  return 0;
+}
+
+static char* all_tests(void) {
+  mu_run_test(frozen_values);
+  mu_run_test(frozen_not_received);
+  mu_run_test(lazy_load);
+  return 0;
+}
+
+// Test application entry point.
+int main(int argc, char **argv) {
+  return unit_main("Running Frozen Tests", all_tests);
+}
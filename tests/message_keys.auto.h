@@ -15,4 +15,9 @@
 #define MESSAGE_KEY_favorite_drink_no_default 14
 #define MESSAGE_KEY_slider_no_default 15
 #define MESSAGE_KEY_email_no_default 16
-#define MESSAGE_KEY_input_time 17
\ No newline at end of file
+#define MESSAGE_KEY_input_time 17
+#define MESSAGE_KEY_enamel_remaining 18
+#define MESSAGE_KEY_enamel_sequence 19
+#define MESSAGE_KEY_enamel_resync 20
+#define MESSAGE_KEY_fg 21
+#define MESSAGE_KEY_signature 22
\ No newline at end of file
@@ -1,6 +1,19 @@
 #include <pebble-events/pebble-events.h>
 
+uint32_t stub_inbox_size;
+// Inbox handler registered by enamel.c, called by the tests with their messages
+AppMessageInboxReceived stub_received_callback;
+
+EventHandle events_app_message_register_inbox_received(AppMessageInboxReceived received_callback, void *context){
+	stub_received_callback = received_callback;
+	return NULL;
+}
+
 void events_app_message_request_inbox_size(uint32_t size){
+	stub_inbox_size = size;
+}
+
+void events_app_message_request_outbox_size(uint32_t size){
 }
 
 void events_app_message_unsubscribe(EventHandle handle){
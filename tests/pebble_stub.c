@@ -1,280 +1,284 @@
 #include <pebble.h>
-#include <@smallstoneapps/linked-list/linked-list.h>
 #include "constants.h"
 
-static LinkedRoot* s_persist_root = NULL;
-
-typedef struct SimpleTuplet {
-  uint32_t key;
-  union {
-    struct {
-      uint8_t *data;
-      uint16_t length;
-    } bytes;
-    uint32_t integer;
-  };
-} SimpleTuplet;
-
-#define SimpleTupletBytes(_key, _data, _length) \
-((const SimpleTuplet) { .key = _key, .bytes = { .data = _data, .length = _length }})
-
-#define SimpleTupletInteger(_key, _integer) \
-((const SimpleTuplet) { .key = _key, .integer =  _integer })
-
-static bool prv_tuplet_compare(void* object1, void* object2){
-	SimpleTuplet* t1 = (SimpleTuplet*)object1;
-	SimpleTuplet* t2 = (SimpleTuplet*)object2;
-	return t1->key == t2->key;
+// Number of dict_find and persist_write_data calls, checked by the tests
+uint32_t stub_dict_find_count = 0;
+uint32_t stub_persist_write_count = 0;
+// Number of bytes written by persist_write_data, reported by the benchmark
+uint32_t stub_persist_write_bytes = 0;
+// Number of messages sent and the last one, checked by the tests
+uint32_t stub_outbox_sent_count = 0;
+uint8_t stub_outbox_buffer[64];
+
+// -----------------------------------------------------
+// Persistent storage : open addressing hash table with linear probing
+
+#define PERSIST_CAPACITY 1024
+
+typedef enum {
+	SLOT_EMPTY = 0,
+	SLOT_USED,
+	SLOT_DELETED
+} SlotState;
+
+typedef struct {
+	SlotState state;
+	uint32_t key;
+	uint16_t size;
+	uint8_t data[PERSIST_DATA_MAX_LENGTH];
+} PersistSlot;
+
+static PersistSlot s_persist[PERSIST_CAPACITY];
+
+// Fault injection : after s_short_write_countdown writes, the next write only stores s_short_write_size bytes
+static int32_t s_short_write_countdown = -1;
+static uint16_t s_short_write_size;
+
+void stub_persist_inject_short_write(uint32_t writes_before, uint16_t size){
+	s_short_write_countdown = writes_before;
+	s_short_write_size = size;
 }
 
-bool persist_exists(const uint32_t key){
-	if(!s_persist_root){
-		s_persist_root = linked_list_create_root();
+static uint32_t prv_hash(uint32_t key){
+	key ^= key >> 16;
+	key *= 0x45D9F3Bu;
+	key ^= key >> 16;
+	return key % PERSIST_CAPACITY;
+}
+
+// Return the slot of the key, or the slot where it can be inserted if create is true
+static PersistSlot *prv_find_slot(uint32_t key, bool create){
+	PersistSlot *free_slot = NULL;
+	for(uint32_t i = 0, index = prv_hash(key); i < PERSIST_CAPACITY; i++, index = (index + 1) % PERSIST_CAPACITY){
+		PersistSlot *slot = &s_persist[index];
+		if(slot->state == SLOT_USED && slot->key == key){
+			return slot;
+		}
+		if(slot->state != SLOT_USED && !free_slot){
+			free_slot = slot;
+		}
+		if(slot->state == SLOT_EMPTY){
+			break;
+		}
 	}
-	SimpleTuplet t = { .key = key };
-	return linked_list_contains_compare(s_persist_root, &t, prv_tuplet_compare);
+	return create ? free_slot : NULL;
 }
 
-int32_t persist_read_int(const uint32_t key){
-	if(!s_persist_root){
-		s_persist_root = linked_list_create_root();
+static int prv_write(uint32_t key, const void *data, size_t size){
+	if(size > PERSIST_DATA_MAX_LENGTH){
+		return E_RANGE;
 	}
-	SimpleTuplet t = { .key = key };
-	int16_t index = linked_list_find_compare(s_persist_root, &t, prv_tuplet_compare);
-	if(index != -1){
-		SimpleTuplet* res = (SimpleTuplet*)linked_list_get(s_persist_root, index);
-		return res->integer;
+	PersistSlot *slot = prv_find_slot(key, true);
+	if(!slot){
+		return E_OUT_OF_STORAGE;
 	}
-	return 0;
+	if(s_short_write_countdown == 0 && size > s_short_write_size){
+		size = s_short_write_size;
+	}
+	if(s_short_write_countdown >= 0){
+		s_short_write_countdown--;
+	}
+	slot->state = SLOT_USED;
+	slot->key = key;
+	slot->size = size;
+	memcpy(slot->data, data, size);
+	return size;
 }
 
-int persist_read_data(const uint32_t key, void *buffer, const size_t buffer_size){
-	if(!s_persist_root){
-		s_persist_root = linked_list_create_root();
+bool persist_exists(const uint32_t key){
+	return prv_find_slot(key, false) != NULL;
+}
+
+int persist_get_size(const uint32_t key){
+	PersistSlot *slot = prv_find_slot(key, false);
+	return slot ? slot->size : E_DOES_NOT_EXIST;
+}
+
+int32_t persist_read_int(const uint32_t key){
+	int32_t value = 0;
+	PersistSlot *slot = prv_find_slot(key, false);
+	if(slot){
+		memcpy(&value, slot->data, slot->size < sizeof(value) ? slot->size : sizeof(value));
 	}
-	SimpleTuplet t = { .key = key };
-	int16_t index = linked_list_find_compare(s_persist_root, &t, prv_tuplet_compare);
-	if(index != -1){
-		SimpleTuplet* res = (SimpleTuplet*)linked_list_get(s_persist_root, index);
-		memcpy(buffer, res->bytes.data, buffer_size);
-		return res->bytes.length;
+	return value;
+}
+
+int persist_read_data(const uint32_t key, void *buffer, const size_t buffer_size){
+	PersistSlot *slot = prv_find_slot(key, false);
+	if(!slot){
+		return E_DOES_NOT_EXIST;
 	}
-	return 0;
+	size_t length = slot->size < buffer_size ? slot->size : buffer_size;
+	memcpy(buffer, slot->data, length);
+	return length;
 }
 
 status_t persist_write_int(const uint32_t key, const int32_t value){
-	if(!s_persist_root){
-		s_persist_root = linked_list_create_root();
-	}
-	SimpleTuplet t = SimpleTupletInteger(key, value);
-	int16_t index = linked_list_find_compare(s_persist_root, &t, prv_tuplet_compare);
-	if(index != -1){
-		SimpleTuplet* res = (SimpleTuplet*)linked_list_get(s_persist_root, index);
-		res->integer = value;
-	}
-	else {
-		SimpleTuplet* res = malloc(sizeof(SimpleTuplet));
-		memcpy(res, &t, sizeof(SimpleTuplet));
-		linked_list_append(s_persist_root, res);
-	}
-	return 0;
+	int result = prv_write(key, &value, sizeof(value));
+	return result < 0 ? result : S_SUCCESS;
 }
 
 int persist_write_data(const uint32_t key, const void *data, const size_t size){
-	if(!s_persist_root){
-		s_persist_root = linked_list_create_root();
+	stub_persist_write_count++;
+	int result = prv_write(key, data, size);
+	if(result > 0){
+		stub_persist_write_bytes += result;
 	}
-	SimpleTuplet t = SimpleTupletBytes(key, 0, 0);
-	int16_t index = linked_list_find_compare(s_persist_root, &t, prv_tuplet_compare);
-	if(index != -1){
-		SimpleTuplet* res = (SimpleTuplet*)linked_list_get(s_persist_root, index);
-		if(res->bytes.data)
-			free(res->bytes.data);
-		res->bytes.data = malloc(size);
-		res->bytes.length = size;
-		memcpy(res->bytes.data, data, size);
-	}
-	else {
-		SimpleTuplet* res = malloc(sizeof(SimpleTuplet));
-		memcpy(res, &t, sizeof(SimpleTuplet));
-		res->bytes.data = malloc(size);
-		res->bytes.length = size;
-		memcpy(res->bytes.data, data, size);
-		linked_list_append(s_persist_root, res);
+	return result;
+}
+
+status_t persist_delete(const uint32_t key){
+	PersistSlot *slot = prv_find_slot(key, false);
+	if(!slot){
+		return E_DOES_NOT_EXIST;
 	}
-	return size;
+	slot->state = SLOT_DELETED;
+	return S_SUCCESS;
 }
 
-// struct Dictionary;
-typedef struct Dictionary {
-	LinkedRoot* root;
-	uint16_t index;
-	const uint8_t *buffer;
-	uint16_t size;
-	uint16_t offset;
+// -----------------------------------------------------
+// Dictionary : same byte layout as the Pebble one, a count of tuples followed by the tuples
+
+typedef struct __attribute__((__packed__)) Dictionary {
+	uint8_t count;
+	Tuple head[];
 } Dictionary;
 
-static bool prv_tuple_compare(void* object1, void* object2){
-	Tuple* t1 = (Tuple*)object1;
-	Tuple* t2 = (Tuple*)object2;
-	return t1->key == t2->key;
+static Tuple *prv_next_tuple(const Tuple *tuple){
+	return (Tuple*)((uint8_t*)tuple + sizeof(Tuple) + tuple->length);
 }
 
-static void prv_init_dict(DictionaryIterator *iter){
-	if(!iter->dictionary){
-		iter->dictionary = malloc(sizeof(Dictionary));
-		iter->dictionary->root = linked_list_create_root();
-		iter->dictionary->index = 0;
-	}
+uint32_t dict_size(DictionaryIterator* iter){
+	return (uint8_t*)iter->end - (uint8_t*)iter->dictionary;
 }
 
-uint32_t dict_size(DictionaryIterator* iter){
-	if(iter){
-		prv_init_dict(iter);
+DictionaryResult dict_write_begin(DictionaryIterator *iter, uint8_t * const buffer, const uint16_t size){
+	if(!iter || !buffer || size < sizeof(Dictionary)){
+		return DICT_INVALID_ARGS;
 	}
-	return TUPLE_SIZE * linked_list_count(iter->dictionary->root);
+	iter->dictionary = (Dictionary*)buffer;
+	iter->dictionary->count = 0;
+	iter->cursor = iter->dictionary->head;
+	iter->end = buffer + size;
+	return DICT_OK;
 }
 
-DictionaryResult dict_write_begin(DictionaryIterator *iter, uint8_t * const buffer, const uint16_t size){
-	if(iter){
-		prv_init_dict(iter);
+static DictionaryResult prv_write_tuple(DictionaryIterator *iter, const uint32_t key, TupleType type, const void *data, uint16_t length){
+	if(!iter || !iter->dictionary){
+		return DICT_INVALID_ARGS;
 	}
+	if((uint8_t*)iter->cursor + sizeof(Tuple) + length > (uint8_t*)iter->end){
+		return DICT_NOT_ENOUGH_STORAGE;
+	}
+	iter->cursor->key = key;
+	iter->cursor->type = type;
+	iter->cursor->length = length;
+	memcpy(iter->cursor->value, data, length);
+	iter->cursor = prv_next_tuple(iter->cursor);
+	iter->dictionary->count++;
+	return DICT_OK;
+}
 
-	linked_list_clear(iter->dictionary->root);
-	iter->dictionary->index = 0;
-	iter->dictionary->buffer = buffer;
-	iter->dictionary->size = size;
-	iter->dictionary->offset = 0;
+DictionaryResult dict_write_int32(DictionaryIterator * iter, const uint32_t key, const int32_t value){
+	return prv_write_tuple(iter, key, TUPLE_INT, &value, sizeof(value));
+}
 
-	return 0;
+DictionaryResult dict_write_cstring(DictionaryIterator * iter, const uint32_t key, const char *const cstring){
+	return prv_write_tuple(iter, key, TUPLE_CSTRING, cstring, cstring ? strlen(cstring) + 1 : 0);
 }
 
 uint32_t dict_write_end(DictionaryIterator *iter){
-	if(iter){
-		prv_init_dict(iter);
-		return TUPLE_SIZE * linked_list_count(iter->dictionary->root);
+	if(!iter || !iter->dictionary){
+		return 0;
 	}
-	return 0;
+	iter->end = iter->cursor;
+	return dict_size(iter);
 }
 
 Tuple * dict_read_begin_from_buffer(DictionaryIterator *iter, const uint8_t * const buffer, const uint16_t size){
-	if(iter){
-		prv_init_dict(iter);
-
-		linked_list_clear(iter->dictionary->root);
-		iter->dictionary->index = 0;
-		iter->dictionary->buffer = buffer;
-		iter->dictionary->size = size;
-		iter->dictionary->offset = 0;
-	
-		uint16_t count = size / TUPLE_SIZE;
-		for(uint16_t i=0; i<count; i++){
-			Tuple* t=(Tuple*)(buffer + i*TUPLE_SIZE);
-			linked_list_append(iter->dictionary->root, t);
-		}
+	if(!iter || !buffer || size < sizeof(Dictionary)){
+		return NULL;
 	}
-	return NULL;
+	iter->dictionary = (Dictionary*)buffer;
+	iter->end = buffer + size;
+	return dict_read_first(iter);
 }
 
 Tuple * dict_read_next(DictionaryIterator *iter){
-	if(iter){
-		prv_init_dict(iter);
-		uint16_t count = linked_list_count(iter->dictionary->root);
-		if(count > 0 && iter->dictionary->index < count){
-			return linked_list_get(iter->dictionary->root, iter->dictionary->index++);
-		}
+	Tuple *tuple = iter->cursor;
+	if((uint8_t*)tuple + sizeof(Tuple) > (uint8_t*)iter->end || (uint8_t*)prv_next_tuple(tuple) > (uint8_t*)iter->end){
+		return NULL;
 	}
-	return NULL;
+	iter->cursor = prv_next_tuple(tuple);
+	return tuple;
 }
 
 Tuple * dict_read_first(DictionaryIterator *iter){
-	if(iter){
-		prv_init_dict(iter);
-		uint16_t count = linked_list_count(iter->dictionary->root);
-		if(count > 0){
-			iter->dictionary->index = 0;
-			return linked_list_get(iter->dictionary->root, iter->dictionary->index++);
-		}
-	}
-	return NULL;
-}	
-
-DictionaryResult dict_merge(DictionaryIterator *dest, uint32_t *dest_max_size_in_out,
-                             DictionaryIterator *source,
-                             const bool update_existing_keys_only,
-                             const DictionaryKeyUpdatedCallback key_callback, void *context){
-	uint16_t count = linked_list_count(source->dictionary->root);
-	for(uint16_t i=0; i<count; i++){
-		Tuple* t=(Tuple*)linked_list_get(source->dictionary->root, i);
-		int16_t destindex = linked_list_find_compare(dest->dictionary->root, t, prv_tuple_compare);
-		Tuple* t2=NULL;
-		if(destindex != -1){
-			t2=(Tuple*)linked_list_get(dest->dictionary->root, destindex);
-			memcpy(t2, t, TUPLE_SIZE);
-		}
-		else {
-			if(dest->dictionary->offset < dest->dictionary->size){
-				t2=(Tuple*)(dest->dictionary->buffer + dest->dictionary->offset);
-				dest->dictionary->offset += TUPLE_SIZE;
-				memcpy(t2, t, TUPLE_SIZE);
-				linked_list_append(dest->dictionary->root, t2);
-			}
-		}
+	if(!iter || !iter->dictionary || iter->dictionary->count == 0){
+		return NULL;
 	}
-	return 0;
+	iter->cursor = iter->dictionary->head;
+	return dict_read_next(iter);
 }
 
+// Linear scan, as on the watch
 Tuple *dict_find(const DictionaryIterator *iter, const uint32_t key){
-	if(iter && iter->dictionary && iter->dictionary->root){
-		Tuple t;
-		t.key = key;
-		int16_t index = linked_list_find_compare(iter->dictionary->root, &t, prv_tuple_compare);
-		if(index != -1){
-			return (Tuple*)linked_list_get(iter->dictionary->root, index);
+	stub_dict_find_count++;
+	if(!iter || !iter->dictionary){
+		return NULL;
+	}
+	const Tuple *tuple = iter->dictionary->head;
+	for(uint8_t i = 0; i < iter->dictionary->count; i++){
+		if(tuple->key == key){
+			return (Tuple*)tuple;
 		}
+		tuple = prv_next_tuple(tuple);
 	}
-	return 0;
+	return NULL;
 }
 
-DictionaryResult dict_write_int32(DictionaryIterator * iter, const uint32_t key, const int32_t value){
-	if(iter){
-		prv_init_dict(iter);
-		Tuple t;
-		t.key = key;
-		int16_t index = linked_list_find_compare(iter->dictionary->root, &t, prv_tuple_compare);
-		if(index != -1){
-			Tuple* res = (Tuple*)linked_list_get(iter->dictionary->root, index);
-			res->value->uint32 = value;
-		}
-		else if(iter->dictionary->offset < iter->dictionary->size){
-			Tuple* res=(Tuple*)(iter->dictionary->buffer + iter->dictionary->offset);
-			iter->dictionary->offset += TUPLE_SIZE;
-			res->key = key;
-			res->value->int32 = value;
-			linked_list_append(iter->dictionary->root, res);
-		}
+// Single pending timer, fired by the tests with stub_app_timer_fire
+static AppTimer *s_timer;
+static AppTimerCallback s_timer_callback;
+static void *s_timer_data;
+
+AppTimer* app_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void* callback_data){
+	s_timer = (AppTimer*)&s_timer;
+	s_timer_callback = callback;
+	s_timer_data = callback_data;
+	return s_timer;
+}
+
+bool app_timer_reschedule(AppTimer *timer_handle, uint32_t new_timeout_ms){
+	return timer_handle == s_timer && s_timer != NULL;
+}
+
+void app_timer_cancel(AppTimer *timer_handle){
+	if(timer_handle == s_timer){
+		s_timer = NULL;
 	}
-	return 0;
 }
 
-DictionaryResult dict_write_cstring(DictionaryIterator * iter, const uint32_t key, const char *const cstring){
-	if(iter){
-		prv_init_dict(iter);
-		Tuple t;
-		t.key = key;
-		int16_t index = linked_list_find_compare(iter->dictionary->root, &t, prv_tuple_compare);
-		if(index != -1){
-			Tuple* res = (Tuple*)linked_list_get(iter->dictionary->root, index);
-			linked_list_remove(iter->dictionary->root, index);
-			free(res);
-		}
-		else if(iter->dictionary->offset < iter->dictionary->size){
-			Tuple* res=(Tuple*)(iter->dictionary->buffer + iter->dictionary->offset);
-			iter->dictionary->offset += TUPLE_SIZE;
-			res->key = key;
-			strcpy(res->value->cstring, cstring);
-			linked_list_append(iter->dictionary->root, res);
-		}		
+bool stub_app_timer_fire(){
+	if(!s_timer){
+		return false;
 	}
-	return 0;
+	s_timer = NULL;
+	s_timer_callback(s_timer_data);
+	return true;
+}
+
+// Outbox : the message is written in stub_outbox_buffer, read by the tests with dict_read_begin_from_buffer
+static DictionaryIterator s_outbox;
+
+AppMessageResult app_message_outbox_begin(DictionaryIterator **iterator){
+	dict_write_begin(&s_outbox, stub_outbox_buffer, sizeof(stub_outbox_buffer));
+	*iterator = &s_outbox;
+	return APP_MSG_OK;
+}
+
+AppMessageResult app_message_outbox_send(void){
+	dict_write_end(&s_outbox);
+	stub_outbox_sent_count++;
+	return APP_MSG_OK;
 }
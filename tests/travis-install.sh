@@ -13,11 +13,11 @@ touch tests/include/pebble/pebble_warn_unsupported_functions.h
 rm $SDK_ZIP_NAME
 rm -r sdk-core
 
-mkdir -p tests/include/@smallstoneapps/linked-list
-wget https://raw.githubusercontent.com/smallstoneapps/linked-list/master/include/linked-list.h
-mv linked-list.h tests/include/@smallstoneapps/linked-list/linked-list.h
-wget https://raw.githubusercontent.com/smallstoneapps/linked-list/master/src/c/linked-list.c
-mv linked-list.c tests/linked-list.c
-
 mkdir -p tests/generated
-python enamel.py --config tests/config.json --folder tests/generated
\ No newline at end of file
+python enamel.py --config tests/config.json --folder tests/generated --budget tests/budget.json
+
+mkdir -p tests/generated-frozen
+python enamel.py --config tests/config.json --folder tests/generated-frozen --frozen tests/frozen.json
+
+mkdir -p tests/generated-used
+python enamel.py --config tests/config.json --folder tests/generated-used --sources tests/used.c
@@ -0,0 +1,33 @@
+#include <stdio.h>
+#include <string.h>
+#include "unit.h"
+
+// Colour code definitions to make the output all pretty.
+#define KNRM  "\x1B[0m"
+#define KRED  "\x1B[31m"
+#define KGRN  "\x1B[32m"
+#define KCYN  "\x1B[36m"
+
+// Width of the title in the banner
+#define TITLE_WIDTH 22
+
+// Keep track of how many tests have run, and how many have passed.
+int tests_run = 0;
+int tests_passed = 0;
+
+// Executes all the tests and prints the results in pretty colours.
+int unit_main(const char *title, char *(*all_tests)(void)) {
+  int padding = TITLE_WIDTH - (int)strlen(title);
+  printf("%s------------------------\n", KCYN);
+  printf("|%*s%s%*s|\n", padding / 2, "", title, padding - padding / 2, "");
+  printf("------------------------\n%s", KNRM);
+  char* result = all_tests();
+  if (0 != result) {
+    printf("%s- Failed Test:%s %s\n", KRED, KNRM, result);
+  }
+  printf("- Tests Run: %s%d%s\n", (tests_run == tests_passed) ? KGRN : KRED, tests_run, KNRM);
+  printf("- Tests Passed: %s%d%s\n", (tests_run == tests_passed) ? KGRN : KRED, tests_passed, KNRM);
+
+  printf("%s------------------------%s\n", KCYN, KNRM);
+  return result != 0;
+}
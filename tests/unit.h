@@ -16,4 +16,7 @@
 } while (0)
 
 extern int tests_run;
-extern int tests_passed;
\ No newline at end of file
+extern int tests_passed;
+
+// Runs all_tests with the banner title and prints the results, returns the exit code of the test application
+int unit_main(const char *title, char *(*all_tests)(void));
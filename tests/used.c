@@ -0,0 +1,122 @@
+#include <pebble.h>
+#include "unit.h"
+#include "enamel.h"
+#include <pebble-events/pebble-events.h>
+#include "constants.h"
+
+// Tests of the helpers generated with --sources tests/used.c, built for aplite
+
+// A getter only referenced by a macro is used
+#define FONT_SIZE() enamel_get_font_size()
+
+extern uint32_t stub_inbox_size;
+
+extern AppMessageInboxReceived stub_received_callback;
+
+static void before_each(void) {
+  enamel_init();
+}
+
+static void after_each(void) {
+  enamel_deinit();
+}
+
+static char* used_settings(void) {
+  printf("used_settings\n");
+#if !defined(ENAMEL_HASH_SLIDER) || !defined(ENAMEL_HASH_EMAIL) || !defined(ENAMEL_HASH_FONT_SIZE)
+  mu_assert(false, "settings used by the sources should be generated");
+#endif
+#if defined(ENAMEL_HASH_FLAVOR) || defined(ENAMEL_HASH_INPUT_TIME)
+  mu_assert(false, "settings not used by the sources should not be generated");
+#endif
+#if defined(ENAMEL_HASH_BACKGROUND)
+  mu_assert(false, "settings only used on color platforms should not be generated on aplite");
+#endif
+  mu_assert(ENAMEL_SETTINGS_COUNT == 5, "only the used settings should be indexed");
+  mu_assert(ENAMEL_SETTING_FG == 4, "a messageKey of sections with exclusive capabilities should be indexed once");
+
+  mu_assert(FONT_SIZE_NORMAL == FONT_SIZE(), "settings used in a macro should be generated");
+  mu_assert(1500 == enamel_get_slider(), "enamel_get_slider wrong default value");
+  mu_assert(strcmp("gregoire@test.fr", enamel_get_email()) == 0, "enamel_get_email wrong default value");
+#ifdef PBL_COLOR
+  mu_assert(GColorFromHEX(0xFF0000).argb == enamel_get_background().argb, "enamel_get_background wrong default value");
+  mu_assert(GColorFromHEX(0x00AAFF).argb == enamel_get_fg().argb, "enamel_get_fg should use the default of the COLOR section");
+#else
+  mu_assert(GColorFromHEX(0xFFFFFF).argb == enamel_get_fg().argb, "enamel_get_fg should use the default of the BW section");
+#endif
+  return 0;
+}
+
+static char* used_received(void) {
+  printf("used_received\n");
+  DictionaryIterator iterator;
+  uint8_t dict_buffer[TUPLE_SIZE * 3];
+  dict_write_begin(&iterator, dict_buffer, sizeof(dict_buffer));
+  dict_write_int32(&iterator, MESSAGE_KEY_slider, 500);
+  dict_write_int32(&iterator, MESSAGE_KEY_flavor, 1);
+  dict_write_end(&iterator);
+  stub_received_callback(&iterator, NULL);
+
+  mu_assert(500 == enamel_get_slider(), "used settings should change");
+  return 0;
+}
+
+static char* clay_settings(void) {
+  printf("clay_settings\n");
+  // Clay sends every messageKey shown on aplite, used or not, with their largest values : the integers and booleans
+  // as int32, the select values and the times as strings
+  static const uint32_t int_keys[] = {
+    MESSAGE_KEY_enable_background, MESSAGE_KEY_enable_background_no_default, MESSAGE_KEY_background,
+    MESSAGE_KEY_background_no_default, MESSAGE_KEY_favoritefood, MESSAGE_KEY_favoritefood + 1, MESSAGE_KEY_favoritefood + 2,
+    MESSAGE_KEY_slider, MESSAGE_KEY_slider_nostep, MESSAGE_KEY_slider_no_default, MESSAGE_KEY_fg,
+    MESSAGE_KEY_enamel_sequence, MESSAGE_KEY_enamel_resync
+  };
+  char email[ENAMEL_MAX_STRING_LENGTH];
+  memset(email, 'e', sizeof(email) - 1);
+  email[sizeof(email) - 1] = '\0';
+  char email_no_default[4 * 16 + 1];
+  memset(email_no_default, 'n', sizeof(email_no_default) - 1);
+  email_no_default[sizeof(email_no_default) - 1] = '\0';
+  char signature[4 * 80 + 1];
+  memset(signature, 's', sizeof(signature) - 1);
+  signature[sizeof(signature) - 1] = '\0';
+
+  uint8_t *dict_buffer = malloc(stub_inbox_size);
+  DictionaryIterator iterator;
+  dict_write_begin(&iterator, dict_buffer, stub_inbox_size);
+  bool written = true;
+  for(uint32_t i = 0; i < sizeof(int_keys) / sizeof(int_keys[0]); i++){
+    written = written && dict_write_int32(&iterator, int_keys[i], int_keys[i] == MESSAGE_KEY_enamel_sequence ? 0 : 1) == DICT_OK;
+  }
+  written = written && dict_write_cstring(&iterator, MESSAGE_KEY_font_size, "2") == DICT_OK;
+  written = written && dict_write_cstring(&iterator, MESSAGE_KEY_font_size_no_default, "2") == DICT_OK;
+  written = written && dict_write_cstring(&iterator, MESSAGE_KEY_favorite_drink, "water") == DICT_OK;
+  written = written && dict_write_cstring(&iterator, MESSAGE_KEY_favorite_drink_no_default, "water") == DICT_OK;
+  written = written && dict_write_cstring(&iterator, MESSAGE_KEY_flavor, "chocolate") == DICT_OK;
+  written = written && dict_write_cstring(&iterator, MESSAGE_KEY_email, email) == DICT_OK;
+  written = written && dict_write_cstring(&iterator, MESSAGE_KEY_email_no_default, email_no_default) == DICT_OK;
+  written = written && dict_write_cstring(&iterator, MESSAGE_KEY_signature, signature) == DICT_OK;
+  written = written && dict_write_cstring(&iterator, MESSAGE_KEY_input_time, "23:59:59") == DICT_OK;
+  dict_write_end(&iterator);
+  if(written){
+    stub_received_callback(&iterator, NULL);
+  }
+  free(dict_buffer);
+
+  mu_assert(written, "the inbox should hold all the settings sent by Clay, used or not");
+  mu_assert(1 == enamel_get_slider(), "the used settings of a message from Clay should change");
+  mu_assert(strcmp(email, enamel_get_email()) == 0, "the used strings of a message from Clay should change");
+  return 0;
+}
+
+static char* all_tests(void) {
+  mu_run_test(used_settings);
+  mu_run_test(used_received);
+  mu_run_test(clay_settings);
+  return 0;
+}
+
+// Test application entry point.
+int main(int argc, char **argv) {
+  return unit_main("Running Used Tests", all_tests);
+}